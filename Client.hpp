@@ -0,0 +1,133 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "Clock.hpp"
+#include "message.pb.h"
+
+struct Client {
+ private:
+  std::string ip;
+  short port;
+  int sockfd = -1;
+
+  bool receive_exactly(char* buffer, size_t size) {
+    size_t bytesReceived = 0;
+    while (bytesReceived < size) {
+      ssize_t numRecv =
+          recv(sockfd, buffer + bytesReceived, size - bytesReceived, 0);
+      if (numRecv == -1) {
+        std::cerr << "Error: Failed to receive message" << std::endl;
+        return false;
+      }
+      if (numRecv == 0) {
+        std::cerr << "Connection closed by board" << std::endl;
+        return false;
+      }
+      bytesReceived += numRecv;
+    }
+    return true;
+  }
+
+ public:
+  Client(std::string ip, short port) : ip(std::move(ip)), port(port) {}
+  ~Client() {
+    // Close the socket
+    close(sockfd);
+  }
+
+  bool connect_to_server() {
+    // Create a TCP socket to connect to the remote device
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+      std::cerr << "Error: Failed to create socket" << std::endl;
+      return false;
+    }
+
+    // Connect to the remote device
+    struct sockaddr_in remoteAddr {};
+    memset(&remoteAddr, 0, sizeof(remoteAddr));
+    remoteAddr.sin_family = AF_INET;
+    remoteAddr.sin_addr.s_addr = inet_addr(ip.c_str());
+    remoteAddr.sin_port = htons(port);
+    if (connect(sockfd, (struct sockaddr*)&remoteAddr, sizeof(remoteAddr)) ==
+        -1) {
+      std::cerr << "Error: Failed to connect to remote device" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool send_message(MyMessage& message) {
+    // Serialize the message to a byte array
+    stampSent(message);
+    std::string messageData;
+    message.SerializeToString(&messageData);
+    size_t size = messageData.size();
+
+    // Send the message size to the socket, so the board can frame requests
+    ssize_t numSent = send(sockfd, &size, sizeof(size), 0);
+    if (numSent != sizeof(size)) {
+      std::cerr << "Error: Failed to send message size" << std::endl;
+      return false;
+    }
+
+    // Send the message data to the socket
+    size_t bytesSent = 0;
+    while (bytesSent < size) {
+      numSent = send(sockfd, messageData.data() + bytesSent, size - bytesSent,
+                     0);
+      if (numSent == -1) {
+        std::cerr << "Error: Failed to send message" << std::endl;
+        return false;
+      }
+      bytesSent += numSent;
+    }
+    return true;
+  }
+
+  bool receive_message(MyMessage& message) {
+    // Read size of data from the socket
+    size_t size;
+    if (!receive_exactly(reinterpret_cast<char*>(&size), sizeof(size))) {
+      return false;
+    }
+
+    // Read the message data from the socket
+    std::string buffer(size, '\0');
+    if (!receive_exactly(buffer.data(), size)) {
+      return false;
+    }
+
+    // Parse the message from the received data
+    if (!message.ParseFromString(buffer)) {
+      std::cerr << "Error: Failed to parse message" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Receives the reply to the request with the given id, dropping any reply
+  // meant for an earlier request
+  bool receive_reply(int32_t id, MyMessage& message) {
+    while (receive_message(message)) {
+      if (message.id() == id) {
+        return true;
+      }
+      std::cerr << "Dropping stale reply " << message.id() << std::endl;
+    }
+    return false;
+  }
+
+  // Pixels of a received image, which are always inline over TCP
+  std::string_view image_data(const MyMessage::Image& image) const {
+    return image.data();
+  }
+
+  bool image_intact(const MyMessage::Image&) const { return true; }
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "message.pb.h"
+
+// Monotonic time for measuring stage durations on one machine
+inline int64_t monotonicNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Wall-clock time for comparing readings across the link
+inline int64_t wallNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+inline double secondsSinceEpoch() { return wallNanoseconds() / 1e9; }
+
+inline void stamp(MyMessage::StageTime* time) {
+  time->set_monotonic_ns(monotonicNanoseconds());
+  time->set_wall_ns(wallNanoseconds());
+}
+
+// Records when a message leaves the transport, if it carries timestamps.
+// Serialized and sent get placeholder readings, which the transport
+// overwrites in the serialized bytes once those moments come.
+inline void stampSent(MyMessage& message) {
+  message.set_time_sent(secondsSinceEpoch());
+  if (message.has_timestamps()) {
+    stamp(message.mutable_timestamps()->mutable_serialized());
+    stamp(message.mutable_timestamps()->mutable_sent());
+  }
+}
+
+// Serialized and sent are the last two fields of a message stamped by
+// stampSent, and each encodes to a fixed 20 bytes: the field tag, the
+// length, then both readings as tagged 8-byte values
+constexpr size_t kStageTimeBytes = 20;
+
+inline bool endsWithStageTime(const char* end, uint8_t tag) {
+  const uint8_t* bytes =
+      reinterpret_cast<const uint8_t*>(end - kStageTimeBytes);
+  return bytes[0] == tag && bytes[1] == kStageTimeBytes - 2 &&
+         bytes[2] == 0x09 && bytes[11] == 0x11;
+}
+
+inline void writeFixed64(char* dst, int64_t value) {
+  uint64_t bits = static_cast<uint64_t>(value);
+  for (int i = 0; i < 8; i++) {
+    dst[i] = static_cast<char>(bits >> (8 * i));
+  }
+}
+
+// Stamps the serialized (field 6) or sent (field 7) stage again, both in
+// the message and in the bytes it was serialized to. Messages that do not
+// end with both stages are left alone.
+inline void restampTrailing(MyMessage& message, char* data, size_t size,
+                            int field) {
+  if (!message.has_timestamps() || size < 2 * kStageTimeBytes ||
+      !endsWithStageTime(data + size, (7 << 3) | 2) ||
+      !endsWithStageTime(data + size - kStageTimeBytes, (6 << 3) | 2)) {
+    return;
+  }
+  MyMessage::Timestamps* timestamps = message.mutable_timestamps();
+  MyMessage::StageTime* time = field == 6 ? timestamps->mutable_serialized()
+                                          : timestamps->mutable_sent();
+  char* bytes = data + size - kStageTimeBytes * (8 - field);
+  stamp(time);
+  writeFixed64(bytes + 3, time->monotonic_ns());
+  writeFixed64(bytes + 12, time->wall_ns());
+}
+
+// Called right after serializing a message stamped by stampSent
+inline void restampSerialized(MyMessage& message, char* data, size_t size) {
+  restampTrailing(message, data, size, 6);
+}
+
+// Called right before the serialized bytes are written out
+inline void restampSent(MyMessage& message, char* data, size_t size) {
+  restampTrailing(message, data, size, 7);
+}
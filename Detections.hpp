@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "message.pb.h"
+
+// Columns are copied to and from the wire in host byte order
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Detections encoding requires a little-endian target"
+#endif
+
+// Wire layout of MyMessage::Reply::Detections, for N detections:
+//   class_ids    N packed varints, indexing the reply's class_table
+//   boxes        N * 4 int16 (x_min, y_min, x_max, y_max) in pixels
+//   confidences  N uint8, confidence quantized to [0, 255]
+struct Detection {
+  uint32_t class_id;
+  int16_t x_min;
+  int16_t y_min;
+  int16_t x_max;
+  int16_t y_max;
+  float confidence;
+};
+
+constexpr size_t kBoxColumnSize = 4 * sizeof(int16_t);
+
+inline int16_t clamp_coordinate(float value) {
+  return static_cast<int16_t>(std::clamp(std::lround(value), 0L, 32767L));
+}
+
+inline uint8_t quantize_confidence(float confidence) {
+  return static_cast<uint8_t>(
+      std::lround(std::clamp(confidence, 0.f, 1.f) * 255.f));
+}
+
+inline float dequantize_confidence(uint8_t confidence) {
+  return confidence / 255.f;
+}
+
+inline void pack_class_table(const std::vector<std::string>& class_labels,
+                             MyMessage::Reply* dst) {
+  dst->mutable_class_table()->Assign(class_labels.begin(),
+                                     class_labels.end());
+}
+
+inline void pack_detections(const std::vector<Detection>& detections,
+                            MyMessage::Reply::Detections* dst) {
+  size_t count = detections.size();
+
+  // Fill each column in a single pass over the detections
+  std::vector<int16_t> boxes(count * 4);
+  std::string confidences(count, '\0');
+  dst->mutable_class_ids()->Reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    const Detection& det = detections[i];
+    dst->add_class_ids(det.class_id);
+    boxes[i * 4 + 0] = det.x_min;
+    boxes[i * 4 + 1] = det.y_min;
+    boxes[i * 4 + 2] = det.x_max;
+    boxes[i * 4 + 3] = det.y_max;
+    confidences[i] = static_cast<char>(quantize_confidence(det.confidence));
+  }
+
+  dst->set_boxes(boxes.data(), count * kBoxColumnSize);
+  dst->set_confidences(std::move(confidences));
+}
+
+inline bool unpack_detections(const MyMessage::Reply::Detections& src,
+                              std::vector<Detection>& detections) {
+  size_t count = src.class_ids_size();
+  if (src.boxes().size() != count * kBoxColumnSize ||
+      src.confidences().size() != count) {
+    return false;
+  }
+
+  std::vector<int16_t> boxes(count * 4);
+  std::memcpy(boxes.data(), src.boxes().data(), src.boxes().size());
+
+  detections.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    Detection& det = detections[i];
+    det.class_id = src.class_ids(i);
+    det.x_min = boxes[i * 4 + 0];
+    det.y_min = boxes[i * 4 + 1];
+    det.x_max = boxes[i * 4 + 2];
+    det.y_max = boxes[i * 4 + 3];
+    det.confidence =
+        dequantize_confidence(static_cast<uint8_t>(src.confidences()[i]));
+  }
+  return true;
+}
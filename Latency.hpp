@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "message.pb.h"
+
+// Samples of one latency figure, summarized as percentiles
+struct LatencySeries {
+  std::string name;
+  std::vector<double> samples_ms;
+
+  explicit LatencySeries(std::string name) : name(std::move(name)) {}
+
+  void add(int64_t nanoseconds) { samples_ms.push_back(nanoseconds / 1e6); }
+
+  static double percentile(const std::vector<double> &sorted, double p) {
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+  }
+
+  void print() const {
+    if (samples_ms.empty()) {
+      return;
+    }
+    std::vector<double> sorted = samples_ms;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double sample : sorted) sum += sample;
+    std::cout << "  " << name << ": n=" << sorted.size()
+              << " mean=" << sum / sorted.size()
+              << " p50=" << percentile(sorted, 0.5)
+              << " p95=" << percentile(sorted, 0.95)
+              << " max=" << sorted.back() << " ms" << std::endl;
+  }
+};
+
+// Splits each round trip into board stages and network time
+struct LatencyTracker {
+  LatencySeries end_to_end{"end-to-end"};
+  LatencySeries network{"network"};
+  LatencySeries uplink{"uplink"};
+  LatencySeries downlink{"downlink"};
+  LatencySeries board{"board"};
+  LatencySeries queue_capture{"queue+capture"};
+  LatencySeries inference{"inference"};
+  LatencySeries postprocess{"postprocess"};
+  LatencySeries serialize{"serialize"};
+  bool has_offset = false;
+  int64_t clock_offset_ns = 0;  // Board wall clock minus host wall clock
+
+  // Host readings are taken around send and receive, in both clocks
+  void add(const MyMessage::Timestamps &ts, int64_t host_sent_mono,
+           int64_t host_received_mono, int64_t host_sent_wall,
+           int64_t host_received_wall) {
+    int64_t round_trip = host_received_mono - host_sent_mono;
+    int64_t on_board = ts.sent().monotonic_ns() - ts.received().monotonic_ns();
+    end_to_end.add(round_trip);
+    board.add(on_board);
+    network.add(round_trip - on_board);
+    if (has_offset) {
+      uplink.add(ts.received().wall_ns() - clock_offset_ns - host_sent_wall);
+      downlink.add(host_received_wall + clock_offset_ns - ts.sent().wall_ns());
+    }
+    if (ts.has_captured()) {
+      queue_capture.add(ts.captured().monotonic_ns() -
+                        ts.received().monotonic_ns());
+      inference.add(ts.inference_end().monotonic_ns() -
+                    ts.inference_start().monotonic_ns());
+      postprocess.add(ts.postprocessed().monotonic_ns() -
+                      ts.inference_end().monotonic_ns());
+      serialize.add(ts.serialized().monotonic_ns() -
+                    ts.postprocessed().monotonic_ns());
+    }
+  }
+
+  void print() const {
+    std::cout << "Latency summary:" << std::endl;
+    for (auto *series :
+         {&end_to_end, &network, &uplink, &downlink, &board, &queue_capture,
+          &inference, &postprocess, &serialize}) {
+      series->print();
+    }
+  }
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "message.pb.h"
+
+// Metrics are registered once at startup and then updated from the hot path
+// with relaxed atomics only; rendering reads them without stopping writers.
+
+struct Counter {
+  std::atomic<uint64_t> value{0};
+
+  void inc(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct Gauge {
+  std::atomic<double> value{0.0};
+
+  void set(double v) { value.store(v, std::memory_order_relaxed); }
+  double get() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct Histogram {
+  // Upper bounds in seconds, covering 100 us to 10 s
+  static constexpr double kBounds[] = {0.0001, 0.00025, 0.0005, 0.001,
+                                       0.0025, 0.005,   0.01,   0.025,
+                                       0.05,   0.1,     0.25,   0.5,
+                                       1.0,    2.5,     5.0,    10.0};
+  static constexpr size_t kNumBuckets = sizeof(kBounds) / sizeof(kBounds[0]);
+
+  std::atomic<uint64_t> buckets[kNumBuckets + 1]{};  // Last bucket is +Inf
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum_ns{0};
+
+  void observe(double seconds) {
+    size_t i = 0;
+    while (i < kNumBuckets && seconds > kBounds[i]) {
+      i++;
+    }
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum_ns.fetch_add(static_cast<uint64_t>(seconds * 1e9),
+                     std::memory_order_relaxed);
+  }
+  double sum() const { return sum_ns.load(std::memory_order_relaxed) / 1e9; }
+};
+
+class MetricsRegistry {
+ public:
+  Counter& counter(const std::string& name, const std::string& help,
+                   const std::string& labels = "") {
+    return add<Counter>(COUNTER, name, help, labels);
+  }
+  Gauge& gauge(const std::string& name, const std::string& help,
+               const std::string& labels = "") {
+    return add<Gauge>(GAUGE, name, help, labels);
+  }
+  Histogram& histogram(const std::string& name, const std::string& help,
+                       const std::string& labels = "") {
+    return add<Histogram>(HISTOGRAM, name, help, labels);
+  }
+
+  // Renders every metric in the Prometheus text exposition format
+  std::string render() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    const std::string* last_name = nullptr;
+    for (auto& entry : entries) {
+      // Families are registered contiguously, so print their header once
+      if (last_name == nullptr || *last_name != entry.name) {
+        out << "# HELP " << entry.name << " " << entry.help << "\n";
+        out << "# TYPE " << entry.name << " " << type_name(entry.type)
+            << "\n";
+        last_name = &entry.name;
+      }
+      switch (entry.type) {
+        case COUNTER:
+          out << entry.name << braces(entry.labels) << " "
+              << static_cast<const Counter*>(entry.metric.get())->get()
+              << "\n";
+          break;
+        case GAUGE:
+          out << entry.name << braces(entry.labels) << " "
+              << static_cast<const Gauge*>(entry.metric.get())->get() << "\n";
+          break;
+        case HISTOGRAM:
+          render_histogram(out, entry,
+                           *static_cast<const Histogram*>(entry.metric.get()));
+          break;
+      }
+    }
+    return out.str();
+  }
+
+  // Copies every counter and gauge, and each histogram's count and mean,
+  // into a STATS message
+  void snapshot(MyMessage::Stats* stats) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& entry : entries) {
+      std::string name = entry.name + braces(entry.labels);
+      switch (entry.type) {
+        case COUNTER:
+          add_stat(stats, name,
+                   static_cast<const Counter*>(entry.metric.get())->get());
+          break;
+        case GAUGE:
+          add_stat(stats, name,
+                   static_cast<const Gauge*>(entry.metric.get())->get());
+          break;
+        case HISTOGRAM: {
+          auto* hist = static_cast<const Histogram*>(entry.metric.get());
+          uint64_t count = hist->count.load(std::memory_order_relaxed);
+          add_stat(stats, entry.name + "_count" + braces(entry.labels), count);
+          add_stat(stats, entry.name + "_mean" + braces(entry.labels),
+                   count > 0 ? hist->sum() / count : 0.0);
+          break;
+        }
+      }
+    }
+  }
+
+ private:
+  enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+  struct Entry {
+    Type type;
+    std::string name;
+    std::string help;
+    std::string labels;
+    std::shared_ptr<void> metric;
+  };
+
+  template <typename T>
+  T& add(Type type, const std::string& name, const std::string& help,
+         const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto metric = std::make_shared<T>();
+
+    // Keep metrics of the same family next to each other
+    auto pos = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (it->name == name) pos = it + 1;
+    }
+    entries.insert(pos, {type, name, help, labels, metric});
+    return *metric;
+  }
+
+  static const char* type_name(Type type) {
+    switch (type) {
+      case COUNTER:
+        return "counter";
+      case GAUGE:
+        return "gauge";
+      default:
+        return "histogram";
+    }
+  }
+
+  static std::string braces(const std::string& labels) {
+    return labels.empty() ? "" : "{" + labels + "}";
+  }
+
+  static std::string with_le(const std::string& labels, const std::string& le) {
+    return "{" + (labels.empty() ? "" : labels + ",") + "le=\"" + le + "\"}";
+  }
+
+  static void render_histogram(std::ostringstream& out, const Entry& entry,
+                               const Histogram& hist) {
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= Histogram::kNumBuckets; i++) {
+      cumulative += hist.buckets[i].load(std::memory_order_relaxed);
+      std::ostringstream le;
+      if (i < Histogram::kNumBuckets) {
+        le << Histogram::kBounds[i];
+      } else {
+        le << "+Inf";
+      }
+      out << entry.name << "_bucket" << with_le(entry.labels, le.str()) << " "
+          << cumulative << "\n";
+    }
+    out << entry.name << "_sum" << braces(entry.labels) << " " << hist.sum()
+        << "\n";
+    out << entry.name << "_count" << braces(entry.labels) << " "
+        << hist.count.load(std::memory_order_relaxed) << "\n";
+  }
+
+  static void add_stat(MyMessage::Stats* stats, const std::string& name,
+                       double value) {
+    MyMessage::Stats::Metric* metric = stats->add_metrics();
+    metric->set_name(name);
+    metric->set_value(value);
+  }
+
+  mutable std::mutex mutex;
+  std::vector<Entry> entries;
+};
+
+// Serves the registry over HTTP on the loopback interface for Prometheus or
+// curl. Every request gets the full metrics page, whatever its path.
+class MetricsServer {
+ public:
+  MetricsServer(const MetricsRegistry& registry, short port)
+      : registry(registry), port(port) {}
+  ~MetricsServer() {
+    // Closing the socket unblocks accept() so the thread can finish
+    running = false;
+    if (listenSockfd != -1) {
+      shutdown(listenSockfd, SHUT_RDWR);
+      close(listenSockfd);
+    }
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  bool start() {
+    listenSockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSockfd == -1) {
+      std::cerr << "Error: Failed to create metrics socket" << std::endl;
+      return false;
+    }
+
+    int reuseaddr = 1;
+    setsockopt(listenSockfd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr,
+               sizeof(reuseaddr));
+
+    // Only listen locally, the endpoint is not authenticated
+    struct sockaddr_in listenAddr {};
+    memset(&listenAddr, 0, sizeof(listenAddr));
+    listenAddr.sin_family = AF_INET;
+    listenAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listenAddr.sin_port = htons(port);
+    if (bind(listenSockfd, (struct sockaddr*)&listenAddr, sizeof(listenAddr)) ==
+            -1 ||
+        listen(listenSockfd, 5) == -1) {
+      std::cerr << "Error: Failed to listen for metrics on port " << port
+                << std::endl;
+      return false;
+    }
+
+    running = true;
+    thread = std::thread(&MetricsServer::serve, this);
+    return true;
+  }
+
+ private:
+  void serve() {
+    while (running) {
+      int sockfd = accept(listenSockfd, nullptr, nullptr);
+      if (sockfd == -1) {
+        continue;
+      }
+
+      // Bound the time an idle or slow client can hold up the endpoint
+      struct timeval timeout {};
+      timeout.tv_sec = 1;
+      setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+      // Drain the request line and headers, which are not inspected
+      char buffer[1024];
+      recv(sockfd, buffer, sizeof(buffer), 0);
+
+      std::string body = registry.render();
+      std::string response =
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/plain; version=0.0.4\r\n"
+          "Content-Length: " +
+          std::to_string(body.size()) +
+          "\r\n"
+          "Connection: close\r\n\r\n" +
+          body;
+      size_t bytesSent = 0;
+      while (bytesSent < response.size()) {
+        ssize_t numSent = send(sockfd, response.data() + bytesSent,
+                               response.size() - bytesSent, MSG_NOSIGNAL);
+        if (numSent <= 0) break;
+        bytesSent += numSent;
+      }
+      close(sockfd);
+    }
+  }
+
+  const MetricsRegistry& registry;
+  short port;
+  int listenSockfd = -1;
+  std::atomic<bool> running{false};
+  std::thread thread;
+};
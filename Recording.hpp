@@ -0,0 +1,291 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Clock.hpp"
+#include "message.pb.h"
+
+// Append-only log of board traffic. The file starts with a RecordingHeader
+// followed by records, each a RecordHeader and its payload padded to 8 bytes,
+// so a reader can map the file and walk it in place. Requests and replies are
+// serialized MyMessages; frames are a FrameHeader followed by raw pixels.
+// A record cut short by a crash is dropped when the file is opened for
+// writing again, so later sessions append after the last complete record.
+
+constexpr char kRecordingMagic[8] = {'K', '2', '6', '0', 'R', 'E', 'C', '\0'};
+constexpr uint32_t kRecordingVersion = 1;
+
+enum RecordType : uint32_t {
+  RECORD_FRAME = 1,
+  RECORD_REQUEST = 2,
+  RECORD_REPLY = 3,
+};
+
+struct RecordingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct RecordHeader {
+  uint32_t type;
+  uint32_t size;  // Payload bytes, without padding
+  int64_t wall_ns;
+  int64_t monotonic_ns;
+};
+
+struct FrameHeader {
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+  int32_t mat_type;
+};
+
+struct RecordView {
+  uint32_t type;
+  int64_t wall_ns;
+  int64_t monotonic_ns;
+  char* data;  // Points into a private mapping, so writes stay local
+  size_t size;
+};
+
+inline size_t record_padding(size_t size) { return (8 - size % 8) % 8; }
+
+class RecordingWriter {
+ public:
+  ~RecordingWriter() {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  bool open(const std::string& path) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {
+      std::cerr << "Error: Failed to open recording " << path << std::endl;
+      return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) == -1) {
+      std::cerr << "Error: Failed to stat recording " << path << std::endl;
+      return false;
+    }
+
+    // Keep appending to an old recording, after its last complete record
+    RecordingHeader header{};
+    std::memcpy(header.magic, kRecordingMagic, sizeof(header.magic));
+    header.version = kRecordingVersion;
+    size_t existing = st.st_size;
+    if (existing >= sizeof(header)) {
+      RecordingHeader old;
+      if (pread(fd, &old, sizeof(old), 0) != sizeof(old) ||
+          std::memcmp(&old, &header, sizeof(header)) != 0) {
+        std::cerr << "Error: Not a recording: " << path << std::endl;
+        return false;
+      }
+      return drop_cut_record(path, existing);
+    }
+
+    // Start a new file with the header, replacing one cut short
+    if (existing > 0) {
+      char old[sizeof(header)];
+      if (pread(fd, old, existing, 0) != static_cast<ssize_t>(existing) ||
+          std::memcmp(old, &header, existing) != 0) {
+        std::cerr << "Error: Not a recording: " << path << std::endl;
+        return false;
+      }
+      if (ftruncate(fd, 0) == -1) {
+        std::cerr << "Error: Failed to truncate recording " << path
+                  << std::endl;
+        return false;
+      }
+    }
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+      std::cerr << "Error: Failed to write recording header" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool append_message(RecordType type, const MyMessage& message) {
+    std::string payload;
+    message.SerializeToString(&payload);
+    return append(type, {{payload.data(), payload.size()}});
+  }
+
+  // Replies are recorded without pixels, which frame records already hold
+  bool append_reply(const MyMessage& reply) {
+    MyMessage stripped = reply;
+    for (auto& frame : *stripped.mutable_reply()->mutable_frames()) {
+      if (frame.has_image()) {
+        frame.mutable_image()->clear_data();
+      }
+      if (frame.has_bounding_box_image()) {
+        frame.mutable_bounding_box_image()->clear_data();
+      }
+    }
+    return append_message(RECORD_REPLY, stripped);
+  }
+
+  bool append_frame(const FrameHeader& frame, const char* pixels,
+                    size_t size) {
+    return append(RECORD_FRAME, {{&frame, sizeof(frame)}, {pixels, size}});
+  }
+
+ private:
+  struct Chunk {
+    const void* data;
+    size_t size;
+  };
+
+  // Walks the records and truncates whatever follows the last complete one,
+  // padding included, so new records are not hidden behind a cut one
+  bool drop_cut_record(const std::string& path, size_t file_size) {
+    size_t offset = sizeof(RecordingHeader);
+    RecordHeader header;
+    while (offset + sizeof(header) <= file_size &&
+           pread(fd, &header, sizeof(header), offset) == sizeof(header)) {
+      size_t end = offset + sizeof(header) + header.size +
+                   record_padding(header.size);
+      if (end > file_size) {
+        break;
+      }
+      offset = end;
+    }
+    if (offset == file_size) {
+      return true;
+    }
+    std::cerr << "Warning: Dropping " << file_size - offset
+              << " bytes of a cut record from " << path << std::endl;
+    if (ftruncate(fd, offset) == -1) {
+      std::cerr << "Error: Failed to truncate recording " << path
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool append(RecordType type, std::initializer_list<Chunk> chunks) {
+    static const char zeros[8] = {};
+    RecordHeader header{};
+    header.type = type;
+    for (auto& chunk : chunks) {
+      header.size += chunk.size;
+    }
+    header.wall_ns = wallNanoseconds();
+    header.monotonic_ns = monotonicNanoseconds();
+
+    // Gather the record into one write so it lands contiguously
+    std::vector<iovec> iov;
+    iov.push_back({&header, sizeof(header)});
+    for (auto& chunk : chunks) {
+      iov.push_back({const_cast<void*>(chunk.data), chunk.size});
+    }
+    iov.push_back({const_cast<char*>(zeros), record_padding(header.size)});
+    size_t total = sizeof(header) + header.size + record_padding(header.size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd == -1) {
+      return false;
+    }
+    ssize_t written = writev(fd, iov.data(), iov.size());
+    if (written != static_cast<ssize_t>(total)) {
+      std::cerr << "Error: Failed to append to recording" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  int fd = -1;
+  std::mutex mutex;
+};
+
+class RecordingReader {
+ public:
+  ~RecordingReader() {
+    if (base != nullptr) {
+      munmap(base, size);
+    }
+  }
+
+  bool open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      std::cerr << "Error: Failed to open recording " << path << std::endl;
+      return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) == -1 ||
+        static_cast<size_t>(st.st_size) < sizeof(RecordingHeader)) {
+      std::cerr << "Error: Recording is empty: " << path << std::endl;
+      ::close(fd);
+      return false;
+    }
+
+    // Map privately so frames can be handed out as writable buffers
+    size = st.st_size;
+    void* addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Error: Failed to map recording " << path << std::endl;
+      return false;
+    }
+    base = static_cast<char*>(addr);
+
+    auto* header = reinterpret_cast<const RecordingHeader*>(base);
+    if (std::memcmp(header->magic, kRecordingMagic, sizeof(header->magic)) !=
+            0 ||
+        header->version != kRecordingVersion) {
+      std::cerr << "Error: Not a recording: " << path << std::endl;
+      return false;
+    }
+    rewind();
+    return true;
+  }
+
+  void rewind() { offset = sizeof(RecordingHeader); }
+
+  bool next(RecordView& record) {
+    if (base == nullptr || offset + sizeof(RecordHeader) > size) {
+      return false;
+    }
+    RecordHeader header;
+    std::memcpy(&header, base + offset, sizeof(header));
+    size_t end = offset + sizeof(header) + header.size;
+    if (end > size) {
+      return false;
+    }
+    record = {header.type, header.wall_ns, header.monotonic_ns,
+              base + offset + sizeof(header), header.size};
+    offset = end + record_padding(header.size);
+    return true;
+  }
+
+  // Next record of the given type, skipping the others
+  bool next(RecordType type, RecordView& record) {
+    while (next(record)) {
+      if (record.type == type) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  char* base = nullptr;
+  size_t size = 0;
+  size_t offset = 0;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Clock.hpp"
+#include "message.pb.h"
+
+using SteadyClock = std::chrono::steady_clock;
+
+struct PendingRequest {
+  MyMessage message;
+  SteadyClock::time_point received;
+  SteadyClock::time_point deadline = SteadyClock::time_point::max();
+  MyMessage::StageTime received_at;
+
+  explicit PendingRequest(MyMessage message)
+      : message(std::move(message)), received(SteadyClock::now()) {
+    stamp(&received_at);
+    uint32_t deadline_ms = this->message.request().deadline_ms();
+    if (deadline_ms > 0) {
+      deadline = received + std::chrono::milliseconds(deadline_ms);
+    }
+  }
+
+  bool expired(SteadyClock::time_point now) const { return now > deadline; }
+};
+
+// Requests are queued by a receiver thread while the board is busy, and the
+// board takes everything that piled up at once so it can drop stale requests
+// and answer the rest from a single frame.
+class RequestQueue {
+ public:
+  void push(MyMessage message) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      requests.emplace_back(std::move(message));
+    }
+    ready.notify_one();
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    ready.notify_all();
+  }
+
+  // Blocks until a request is queued and takes all queued requests, returns
+  // false once the queue is closed and empty
+  bool pop_all(std::vector<PendingRequest>& out) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this] { return closed || !requests.empty(); });
+    out.assign(std::make_move_iterator(requests.begin()),
+               std::make_move_iterator(requests.end()));
+    requests.clear();
+    return !out.empty();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return requests.size();
+  }
+
+ private:
+  mutable std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<PendingRequest> requests;
+  bool closed = false;
+};
+
+// Picks how much work to skip from a moving average of request latency. The
+// level steps up while the average is over budget and back down once it is
+// comfortably under, waiting a few requests after each change to let the
+// average settle.
+class DegradationController {
+ public:
+  DegradationController(double budget_seconds,
+                        MyMessage::Reply::Degradation max_level)
+      : budget(budget_seconds), max_level(max_level) {}
+
+  void update(double latency_seconds) {
+    if (budget <= 0.0) {
+      return;
+    }
+    average = has_sample ? kSmoothing * latency_seconds +
+                               (1.0 - kSmoothing) * average
+                         : latency_seconds;
+    has_sample = true;
+
+    if (++since_change < kSettleRequests) {
+      return;
+    }
+    if (average > budget && current < max_level) {
+      current = static_cast<MyMessage::Reply::Degradation>(current + 1);
+      since_change = 0;
+    } else if (average < kRecoverFraction * budget &&
+               current > MyMessage::Reply::FULL) {
+      current = static_cast<MyMessage::Reply::Degradation>(current - 1);
+      since_change = 0;
+    }
+  }
+
+  MyMessage::Reply::Degradation level() const { return current; }
+
+ private:
+  static constexpr double kSmoothing = 0.3;
+  static constexpr double kRecoverFraction = 0.5;
+  static constexpr int kSettleRequests = 3;
+
+  double budget;
+  MyMessage::Reply::Degradation max_level;
+  MyMessage::Reply::Degradation current = MyMessage::Reply::FULL;
+  double average = 0.0;
+  bool has_sample = false;
+  int since_change = 0;
+};
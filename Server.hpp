@@ -2,27 +2,48 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
-#include <ctime>
+#include <climits>
+#include <cstdint>
 #include <iostream>
+#include <string>
 
+#include "Clock.hpp"
 #include "message.pb.h"
 
-double secondsSinceEpoch() {
-  // get the current time
-  std::time_t current_time = std::time(nullptr);
-
-  // convert to seconds since the epoch
-  return std::difftime(current_time, 0);
-}
-
 struct Server {
  private:
+  // Requests hold no pixels, so anything larger is a broken stream
+  static constexpr size_t kMaxRequestSize = 64 * 1024;
+
   int listenSockfd = -1;
   short port;
+  uint32_t max_frames;
   int sockfd = -1;
 
+  bool receive_exactly(char* buffer, size_t size) {
+    size_t bytesReceived = 0;
+    while (bytesReceived < size) {
+      ssize_t numRecv =
+          recv(sockfd, buffer + bytesReceived, size - bytesReceived, 0);
+      if (numRecv == -1) {
+        std::cerr << "Error: Failed to receive message" << std::endl;
+        return false;
+      }
+      if (numRecv == 0) {
+        std::cerr << "Connection closed by host" << std::endl;
+        return false;
+      }
+      bytesReceived += numRecv;
+    }
+    return true;
+  }
+
  public:
-  explicit Server(short port) : port(port) {}
+  // Each frame in a reply carries its pixels inline, so replies are capped
+  static constexpr uint32_t kDefaultMaxFrames = 16;
+
+  explicit Server(short port, uint32_t max_frames = kDefaultMaxFrames)
+      : port(port), max_frames(max_frames) {}
   ~Server() {
     // Close the socket and listening socket
     close(sockfd);
@@ -75,7 +96,11 @@ struct Server {
       std::cerr << "Error: Server is not running" << std::endl;
       return false;
     }
-    // Accept an incoming connection
+    // Drop the previous host, if any, and accept the next one
+    if (sockfd != -1) {
+      close(sockfd);
+      sockfd = -1;
+    }
     struct sockaddr_in remoteAddr {};
     socklen_t remoteAddrLen = sizeof(remoteAddr);
     sockfd =
@@ -96,16 +121,26 @@ struct Server {
       std::cerr << "Error: No established connection" << std::endl;
       return false;
     }
-    // Read the message from the socket
-    char buffer[1024];
-    ssize_t numRecv = recv(sockfd, buffer, sizeof(buffer), 0);
-    if (numRecv == -1) {
-      std::cerr << "Error: Failed to receive message" << std::endl;
+    // Read the message size, so back-to-back requests are kept apart
+    size_t size;
+    if (!receive_exactly(reinterpret_cast<char*>(&size), sizeof(size))) {
+      return false;
+    }
+    if (size > kMaxRequestSize) {
+      std::cerr << "Error: Request of " << size << " bytes is too large"
+                << std::endl;
       return false;
     }
 
-    // Parse the message from the byte array
-    message.ParseFromArray(buffer, numRecv);
+    // Read and parse the message data
+    std::string buffer(size, '\0');
+    if (!receive_exactly(buffer.data(), size)) {
+      return false;
+    }
+    if (!message.ParseFromString(buffer)) {
+      std::cerr << "Error: Failed to parse message" << std::endl;
+      return false;
+    }
     return true;
   }
 
@@ -119,13 +154,23 @@ struct Server {
       return false;
     }
     // Serialize the message to a byte array
-    message.set_time_sent(secondsSinceEpoch());
+    stampSent(message);
     size_t size = message.ByteSizeLong();
+    if (size > INT_MAX) {
+      std::cerr << "Error: Message too large to serialize" << std::endl;
+      return false;
+    }
     char* messageData = (char*)malloc(size);
-    message.SerializeToArray(messageData, size);
+    if (messageData == nullptr ||
+        !message.SerializeToArray(messageData, static_cast<int>(size))) {
+      std::cerr << "Error: Failed to serialize message" << std::endl;
+      free(messageData);
+      return false;
+    }
+    restampSerialized(message, messageData, size);
 
     // Send the message size to the socket
-    ssize_t numSent = send(sockfd, &size, sizeof(size), 0);
+    ssize_t numSent = send(sockfd, &size, sizeof(size), MSG_NOSIGNAL);
     if (numSent == -1) {
       std::cerr << "Error: Failed to send message size" << std::endl;
       free(messageData);
@@ -133,9 +178,11 @@ struct Server {
     }
 
     // Send the message data to the socket
+    restampSent(message, messageData, size);
     size_t bytesSent = 0;
     while (bytesSent < size) {
-      numSent = send(sockfd, messageData + bytesSent, size - bytesSent, 0);
+      numSent = send(sockfd, messageData + bytesSent, size - bytesSent,
+                     MSG_NOSIGNAL);
       if (numSent == -1) {
         std::cerr << "Error: Failed to send message" << std::endl;
         free(messageData);
@@ -147,4 +194,12 @@ struct Server {
     free(messageData);
     return true;
   }
+
+  uint32_t max_frames_per_reply() const { return max_frames; }
+
+  // Frames are always carried inline over TCP
+  bool attach_frame(const char* data, size_t size, MyMessage::Image* img) {
+    img->set_data(data, size);
+    return true;
+  }
 };
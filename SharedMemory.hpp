@@ -0,0 +1,465 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "Clock.hpp"
+#include "message.pb.h"
+
+// Shared-memory transport for consumers running on the board itself. The
+// segment holds a request queue, a reply queue and a ring of frame slots.
+// Replies reference their images by slot instead of carrying the pixels, so a
+// local client reads frames in place. Both queues are single-producer,
+// single-consumer and signalled with process-shared futexes, so only one
+// client may attach at a time.
+//
+// A client claims the segment by writing its pid into it. Only the server
+// releases a claim: once the client has detached, or the server finds its
+// process gone, the server empties both queues before the next client can
+// claim the segment. Clients that exit without detaching are found by polling
+// while the server waits on a queue.
+//
+// A frame slot is reused after num_slots further frames have been written.
+// With the usual one-request-one-reply exchange that leaves the frames of the
+// last reply intact until the client has issued num_slots / 2 more requests.
+// Each slot records the sequence number of the frame it holds, which images
+// carry too, so the client can tell when a slot was reused under it.
+// A frame of a reply takes two slots, one per image, so replies are limited
+// to num_slots / 2 frames.
+
+constexpr uint32_t kShmMagic = 0x4b323630;  // "K260"
+constexpr uint32_t kShmQueueLength = 4;
+constexpr size_t kShmMessageSize = 256 * 1024;
+constexpr uint32_t kShmMaxFrameSlots = 16;
+constexpr size_t kShmPageSize = 4096;
+constexpr uint32_t kShmClientGone = UINT32_MAX;  // Detached, not reclaimed yet
+constexpr int kShmPollMs = 200;
+constexpr int kShmClaimAttempts = 50;
+
+// Waits while the word holds expected, up to timeout_ms unless negative
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected,
+                       int timeout_ms = -1) {
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+  struct timespec timeout {};
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected,
+          timeout_ms < 0 ? nullptr : &timeout, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>& word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+}
+
+struct ShmMessageQueue {
+  std::atomic<uint32_t> head;  // Entries written, producer side
+  std::atomic<uint32_t> tail;  // Entries read, consumer side
+  uint32_t sizes[kShmQueueLength];
+  char data[kShmQueueLength][kShmMessageSize];
+
+  bool push(MyMessage& message) {
+    size_t size = message.ByteSizeLong();
+    if (size > kShmMessageSize) {
+      std::cerr << "Error: Message too large for shared memory queue"
+                << std::endl;
+      return false;
+    }
+
+    // Wait for a free entry
+    uint32_t index = head.load(std::memory_order_relaxed);
+    uint32_t read = tail.load(std::memory_order_acquire);
+    while (index - read == kShmQueueLength) {
+      futex_wait(tail, read);
+      read = tail.load(std::memory_order_acquire);
+    }
+
+    // Serialize straight into the entry and publish it
+    uint32_t entry = index % kShmQueueLength;
+    if (!message.SerializeToArray(data[entry], static_cast<int>(size))) {
+      std::cerr << "Error: Failed to serialize message" << std::endl;
+      return false;
+    }
+    restampSerialized(message, data[entry], size);
+    sizes[entry] = size;
+    restampSent(message, data[entry], size);
+    head.store(index + 1, std::memory_order_release);
+    futex_wake(head);
+    return true;
+  }
+
+  bool pop(google::protobuf::MessageLite& message) {
+    // Wait for an entry to be published
+    uint32_t index = tail.load(std::memory_order_relaxed);
+    uint32_t written = head.load(std::memory_order_acquire);
+    while (written == index) {
+      futex_wait(head, written);
+      written = head.load(std::memory_order_acquire);
+    }
+
+    // Parse the entry and release it to the producer
+    uint32_t entry = index % kShmQueueLength;
+    bool parsed = message.ParseFromArray(data[entry], sizes[entry]);
+    tail.store(index + 1, std::memory_order_release);
+    futex_wake(tail);
+    if (!parsed) {
+      std::cerr << "Error: Failed to parse message" << std::endl;
+    }
+    return parsed;
+  }
+
+  // Waits up to timeout_ms for room to push, on the producer side
+  bool wait_writable(int timeout_ms) {
+    uint32_t index = head.load(std::memory_order_relaxed);
+    uint32_t read = tail.load(std::memory_order_acquire);
+    if (index - read < kShmQueueLength) {
+      return true;
+    }
+    futex_wait(tail, read, timeout_ms);
+    return index - tail.load(std::memory_order_acquire) < kShmQueueLength;
+  }
+
+  // Waits up to timeout_ms for an entry to pop, on the consumer side
+  bool wait_readable(int timeout_ms) {
+    uint32_t index = tail.load(std::memory_order_relaxed);
+    uint32_t written = head.load(std::memory_order_acquire);
+    if (written != index) {
+      return true;
+    }
+    futex_wait(head, written, timeout_ms);
+    return head.load(std::memory_order_acquire) != index;
+  }
+
+  // Drops all entries, only while neither side uses the queue
+  void reset() {
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+};
+
+struct ShmFrameSlot {
+  uint64_t size;
+  std::atomic<uint64_t> sequence;  // 0 while the frame is being written
+};
+
+struct ShmHeader {
+  uint32_t magic;
+  uint32_t num_slots;
+  uint64_t slot_size;
+  std::atomic<uint32_t> client_pid;  // 0 when free, or kShmClientGone
+  uint64_t frames_written;  // Written by the server only
+  ShmMessageQueue requests;
+  ShmMessageQueue replies;
+  ShmFrameSlot slots[kShmMaxFrameSlots];
+};
+
+inline size_t shm_frames_offset() {
+  return (sizeof(ShmHeader) + kShmPageSize - 1) / kShmPageSize * kShmPageSize;
+}
+
+inline size_t shm_segment_size(uint32_t num_slots, size_t slot_size) {
+  return shm_frames_offset() + num_slots * slot_size;
+}
+
+struct SharedMemoryServer {
+ private:
+  std::string name;
+  uint32_t num_slots;
+  size_t slot_size;
+  size_t segment_size = 0;
+  ShmHeader* header = nullptr;
+  char* frames = nullptr;
+
+ public:
+  explicit SharedMemoryServer(std::string name, uint32_t num_slots = 8,
+                              size_t slot_size = 1920 * 1080 * 3)
+      : name(std::move(name)),
+        num_slots(std::min(num_slots, kShmMaxFrameSlots)),
+        slot_size(slot_size) {}
+  ~SharedMemoryServer() {
+    // Unmap and remove the segment
+    if (header != nullptr) {
+      munmap(header, segment_size);
+      shm_unlink(name.c_str());
+    }
+  }
+
+  bool start() {
+    if (header != nullptr) {
+      std::cerr << "Error: Server already started" << std::endl;
+      return true;
+    }
+    // Create the shared memory segment, replacing any stale one
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd == -1) {
+      std::cerr << "Error: Failed to create shared memory " << name
+                << std::endl;
+      return false;
+    }
+    segment_size = shm_segment_size(num_slots, slot_size);
+    if (ftruncate(fd, segment_size) == -1) {
+      std::cerr << "Error: Failed to size shared memory" << std::endl;
+      close(fd);
+      shm_unlink(name.c_str());
+      return false;
+    }
+
+    // Map the segment and initialize the header
+    void* addr =
+        mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Error: Failed to map shared memory" << std::endl;
+      shm_unlink(name.c_str());
+      return false;
+    }
+    header = new (addr) ShmHeader{};
+    header->num_slots = num_slots;
+    header->slot_size = slot_size;
+    frames = static_cast<char*>(addr) + shm_frames_offset();
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = kShmMagic;
+    return true;
+  }
+
+  bool accept_connection() {
+    if (header == nullptr) {
+      std::cerr << "Error: Server is not running" << std::endl;
+      return false;
+    }
+    // Reclaim the segment from a previous client, dropping whatever it left
+    // in the queues, so the next client starts from empty queues
+    uint32_t pid = header->client_pid.load(std::memory_order_acquire);
+    if (pid != 0 && !client_attached()) {
+      header->requests.reset();
+      header->replies.reset();
+      header->client_pid.store(0, std::memory_order_release);
+      pid = 0;
+    }
+
+    // Wait for a client to claim the segment
+    while (pid == 0) {
+      futex_wait(header->client_pid, pid);
+      pid = header->client_pid.load(std::memory_order_acquire);
+    }
+    return true;
+  }
+
+  // Returns false once the client has detached or its process is gone
+  bool receive_message(MyMessage& message) {
+    if (header == nullptr) {
+      std::cerr << "Error: Server is not running" << std::endl;
+      return false;
+    }
+    while (!header->requests.wait_readable(kShmPollMs)) {
+      if (!client_attached()) {
+        std::cerr << "Client detached" << std::endl;
+        return false;
+      }
+    }
+    return header->requests.pop(message);
+  }
+
+  bool send_message(MyMessage& message) {
+    if (header == nullptr) {
+      std::cerr << "Error: Server is not running" << std::endl;
+      return false;
+    }
+    // Give up on a client that stopped reading replies by leaving
+    while (!header->replies.wait_writable(kShmPollMs)) {
+      if (!client_attached()) {
+        std::cerr << "Error: Client detached before its reply" << std::endl;
+        return false;
+      }
+    }
+    stampSent(message);
+    return header->replies.push(message);
+  }
+
+  uint32_t max_frames_per_reply() const { return num_slots / 2; }
+
+  // Copies the pixels into the next frame slot and references it from the
+  // image. Frames larger than a slot are refused, as inline pixels would not
+  // fit a queue entry either.
+  bool attach_frame(const char* data, size_t size, MyMessage::Image* img) {
+    if (header == nullptr || size > slot_size) {
+      return false;
+    }
+    // Invalidate the slot while it is rewritten, then publish the new frame
+    uint64_t sequence = ++header->frames_written;
+    uint32_t slot = sequence % num_slots;
+    ShmFrameSlot& frame = header->slots[slot];
+    frame.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(frames + slot * slot_size, data, size);
+    frame.size = size;
+    frame.sequence.store(sequence, std::memory_order_release);
+    img->set_shm_slot(slot + 1);
+    img->set_shm_sequence(sequence);
+    return true;
+  }
+
+ private:
+  bool client_attached() const {
+    uint32_t pid = header->client_pid.load(std::memory_order_acquire);
+    if (pid == 0 || pid == kShmClientGone) {
+      return false;
+    }
+    return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+  }
+};
+
+struct SharedMemoryClient {
+ private:
+  std::string name;
+  size_t segment_size = 0;
+  ShmHeader* header = nullptr;
+  const char* frames = nullptr;
+
+ public:
+  explicit SharedMemoryClient(std::string name) : name(std::move(name)) {}
+  ~SharedMemoryClient() {
+    // Detach from the segment, leaving the claim for the server to release
+    // once it is done with the queues, and wake it if it is waiting on them
+    if (header != nullptr) {
+      header->client_pid.store(kShmClientGone, std::memory_order_release);
+      futex_wake(header->requests.head);
+      futex_wake(header->replies.tail);
+      munmap(header, segment_size);
+    }
+  }
+
+  bool connect_to_server() {
+    // Open the segment created by the server
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+      std::cerr << "Error: Failed to open shared memory " << name << std::endl;
+      return false;
+    }
+
+    // Map the header first to learn the size of the frame ring
+    void* addr = mmap(nullptr, sizeof(ShmHeader), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Error: Failed to map shared memory" << std::endl;
+      close(fd);
+      return false;
+    }
+    auto* probe = static_cast<ShmHeader*>(addr);
+    bool valid = probe->magic == kShmMagic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    size_t size = shm_segment_size(probe->num_slots, probe->slot_size);
+    munmap(addr, sizeof(ShmHeader));
+    if (!valid) {
+      std::cerr << "Error: Shared memory is not initialized" << std::endl;
+      close(fd);
+      return false;
+    }
+
+    // Map the whole segment and claim it, as the queues take one client only
+    addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Error: Failed to map shared memory" << std::endl;
+      return false;
+    }
+    // Retry for a while, as the server may still be reclaiming the segment
+    // from the previous client
+    auto* claimed = static_cast<ShmHeader*>(addr);
+    for (int attempt = 0;; attempt++) {
+      uint32_t free = 0;
+      if (claimed->client_pid.compare_exchange_strong(
+              free, static_cast<uint32_t>(getpid()),
+              std::memory_order_acq_rel)) {
+        break;
+      }
+      if (attempt == kShmClaimAttempts) {
+        std::cerr << "Error: Another client is attached to " << name
+                  << std::endl;
+        munmap(addr, size);
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    segment_size = size;
+    header = claimed;
+    frames = static_cast<const char*>(addr) + shm_frames_offset();
+    futex_wake(header->client_pid);
+    return true;
+  }
+
+  bool send_message(MyMessage& message) {
+    if (header == nullptr) {
+      std::cerr << "Error: Not connected" << std::endl;
+      return false;
+    }
+    stampSent(message);
+    return header->requests.push(message);
+  }
+
+  bool receive_message(MyMessage& message) {
+    if (header == nullptr) {
+      std::cerr << "Error: Not connected" << std::endl;
+      return false;
+    }
+    return header->replies.pop(message);
+  }
+
+  // Receives the reply to the request with the given id, dropping any reply
+  // meant for an earlier request
+  bool receive_reply(int32_t id, MyMessage& message) {
+    while (receive_message(message)) {
+      if (message.id() == id) {
+        return true;
+      }
+      std::cerr << "Dropping stale reply " << message.id() << std::endl;
+    }
+    return false;
+  }
+
+  // Pixels of a received image, read in place from its frame slot. Empty
+  // when the slot already holds a later frame.
+  std::string_view image_data(const MyMessage::Image& image) const {
+    uint32_t slot = image.shm_slot();
+    if (slot == 0 || header == nullptr || slot > header->num_slots) {
+      return image.data();
+    }
+    const ShmFrameSlot& frame = header->slots[slot - 1];
+    if (frame.sequence.load(std::memory_order_acquire) !=
+        image.shm_sequence()) {
+      return {};
+    }
+    return {frames + (slot - 1) * header->slot_size, frame.size};
+  }
+
+  // Whether the pixels returned by image_data were left alone until now, so
+  // call it once done reading them
+  bool image_intact(const MyMessage::Image& image) const {
+    uint32_t slot = image.shm_slot();
+    if (slot == 0 || header == nullptr || slot > header->num_slots) {
+      return true;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header->slots[slot - 1].sequence.load(std::memory_order_relaxed) ==
+           image.shm_sequence();
+  }
+};
@@ -106,30 +106,51 @@ std::vector<ImageResult> YoloModel::run_images(std::vector<Image>& images) {
   std::cout << std::endl
             << "Running " << images.size() << " image(s)." << std::endl;
 
-  for (auto& img : images) {
+  // Run the images in batches of the size the DPU takes at once
+  size_t batch_size = std::max<size_t>(model->get_input_batch(), 1);
+  for (size_t begin = 0; begin < images.size(); begin += batch_size) {
+    size_t end = std::min(begin + batch_size, images.size());
+    std::vector<cv::Mat> batch;
+    for (size_t i = begin; i < end; i++) {
+      batch.push_back(images[i].mat);
+    }
+
     // Run the YOLO model and get the results
     std::cout << std::endl
-              << "Running " << img.path.filename() << "..." << std::endl;
+              << "Running " << batch.size() << " image(s) from "
+              << images[begin].path.filename() << "..." << std::endl;
     t.Start();
-    auto results = model->run(img.mat);
+    auto results = model->run(batch);
     t.Stop();
-    std::cout << "Completed " << img.path.filename() << " in "
-              << t.GetDurationInMilliseconds() << " milliseconds!" << std::endl;
+    std::cout << "Completed batch in " << t.GetDurationInMilliseconds()
+              << " milliseconds!" << std::endl;
     total_duration += t.GetDurationInMilliseconds();
-    img_results.emplace_back(img, results.bboxes, class_labels);
+
+    // Share the batch time evenly between its images
+    for (size_t i = begin; i < end; i++) {
+      img_results.emplace_back(images[i], results[i - begin].bboxes,
+                               class_labels);
+      img_results.back().inference_seconds =
+          t.GetDurationInSeconds() / batch.size();
+      img_results.back().batch_seconds = t.GetDurationInSeconds();
+      img_results.back().batch_size = batch.size();
+    }
   }
 
   std::cout << std::endl
             << "Completed " << images.size() << " image(s) in "
             << total_duration << " milliseconds!" << std::endl;
-  std::cout << "Average time: " << total_duration / images.size() << " ms"
-            << std::endl;
+  if (!images.empty()) {
+    std::cout << "Average time: " << total_duration / images.size() << " ms"
+              << std::endl;
+  }
 
   return img_results;
 }
 
 void YoloModel::process_results(std::vector<ImageResult>& img_results,
-                                bool print_results, bool save_img) {
+                                bool print_results, bool save_img,
+                                bool draw_boxes) {
   for (auto& img_result : img_results) {
     // Iterate through the detected bounding boxes
     for (auto& obj : img_result.objs) {
@@ -142,7 +163,9 @@ void YoloModel::process_results(std::vector<ImageResult>& img_results,
                   << obj.ymin << "\t" << obj.xmax << "\t" << obj.ymax << "\t"
                   << obj.confidence << std::endl;
       }
-      draw_bounding_box(img_result.bbox_img.mat, obj);
+      if (draw_boxes) {
+        draw_bounding_box(img_result.bbox_img.mat, obj);
+      }
     }
 
     // Save the output image
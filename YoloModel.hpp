@@ -54,6 +54,7 @@ struct Image {
 };
 
 struct DetectedObject {
+  int class_id;
   std::string label;
   float xmin;
   float ymin;
@@ -64,7 +65,10 @@ struct DetectedObject {
   DetectedObject(const vitis::ai::YOLOv3Result::BoundingBox& box,
                  const cv::Mat& img,
                  const std::vector<std::string>& class_labels) {
-    label = class_labels[box.label];
+    class_id = box.label;
+    label = box.label < static_cast<int>(class_labels.size())
+                ? class_labels[box.label]
+                : std::to_string(box.label);
     xmin = box.x * img.cols + 1;
     ymin = box.y * img.rows + 1;
     xmax = xmin + box.width * img.cols;
@@ -83,6 +87,9 @@ struct ImageResult {
   Image img;
   Image bbox_img;
   std::vector<DetectedObject> objs;
+  float inference_seconds = 0.f;  // Share of the batch time
+  float batch_seconds = 0.f;      // Time of the whole batch
+  size_t batch_size = 1;
 
   ImageResult(
       const Image& img,
@@ -102,7 +109,12 @@ class YoloModel {
   explicit YoloModel(const std::string& model_path);
   std::vector<ImageResult> run_images(std::vector<Image>& images);
   void process_results(std::vector<ImageResult>& img_results,
-                       bool print_results, bool save_img);
+                       bool print_results, bool save_img,
+                       bool draw_boxes = true);
+  const std::vector<std::string>& get_class_labels() const {
+    return class_labels;
+  }
+  bool is_loaded() const { return model != nullptr; }
 
  private:
   static bool is_image_file(const std::filesystem::path& path);
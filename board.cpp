@@ -1,7 +1,16 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <random>
+#include <thread>
+
+#include "Detections.hpp"
+#include "Metrics.hpp"
+#include "Recording.hpp"
+#include "Scheduler.hpp"
 #include "Server.hpp"
+#include "SharedMemory.hpp"
 #include "YoloModel.hpp"
 
 #include "message.pb.h"
@@ -22,48 +31,237 @@ struct RandomGenerator {
   }
 };
 
-std::vector<Image> get_camera_images(const MyMessage& request) {
+// Frames a request asks for, one per listed camera or num_frames from the
+// default camera
+uint32_t requested_frames(const MyMessage& request) {
+  uint32_t count = request.request().camera_ids_size() > 0
+                       ? request.request().camera_ids_size()
+                       : request.request().num_frames();
+  return std::max<uint32_t>(count, 1);
+}
+
+// Requests can share a capture only when they ask for the same frames
+bool same_frames(const MyMessage& a, const MyMessage& b) {
+  return requested_frames(a) == requested_frames(b) &&
+         std::equal(a.request().camera_ids().begin(),
+                    a.request().camera_ids().end(),
+                    b.request().camera_ids().begin(),
+                    b.request().camera_ids().end());
+}
+
+std::vector<Image> get_camera_images(const MyMessage& request,
+                                     uint32_t count) {
   // TODO: Implement camera control here
   static RandomGenerator rng;
 
   // Load images
-  std::vector<Image> images = YoloModel::load_images("~/code/scenes");
-  unsigned int rand_img_idx = rng.next_in_range(0, images.size() - 1);
-  return std::vector<Image>(images.begin() + rand_img_idx,
-                            images.begin() + rand_img_idx + 1);
+  std::vector<Image> scenes = YoloModel::load_images("~/code/scenes");
+  std::vector<Image> images;
+  if (scenes.empty()) {
+    return images;
+  }
+
+  // Stand in a fixed scene for each camera, or random scenes otherwise
+  for (uint32_t i = 0; i < count; i++) {
+    unsigned int img_idx =
+        request.request().camera_ids_size() > 0
+            ? request.request().camera_ids(i) % scenes.size()
+            : rng.next_in_range(0, scenes.size() - 1);
+    images.push_back(scenes[img_idx]);
+  }
+  return images;
 }
 
-void package_image(const cv::Mat& img_src, MyMessage::Image* img_dst) {
-  // Copy the image data to the img_dst message
-  img_dst->set_data(reinterpret_cast<const char*>(img_src.data),
-                    img_src.total() * img_src.elemSize());
-  img_dst->set_width(img_src.cols);
-  img_dst->set_height(img_src.rows);
-  img_dst->set_channels(img_src.channels());
+// Reads the header of a frame record, failing when the record does not hold
+// the pixels it describes, so a cut or corrupt log cannot send reads past the
+// mapping
+bool read_frame_header(const RecordView& record, FrameHeader& frame) {
+  if (record.size < sizeof(frame)) {
+    return false;
+  }
+  std::memcpy(&frame, record.data, sizeof(frame));
+  if (frame.width <= 0 || frame.height <= 0) {
+    return false;
+  }
+  size_t pixels = static_cast<size_t>(frame.width) * frame.height *
+                  CV_ELEM_SIZE(frame.mat_type);
+  return record.size - sizeof(frame) >= pixels;
+}
+
+// Frames from a recording in capture order, starting over at the end
+struct ReplayCamera {
+  RecordingReader reader;
+  size_t num_frames = 0;
+
+  std::vector<Image> get_images(uint32_t count) {
+    std::vector<Image> images;
+    std::filesystem::path dir = std::filesystem::current_path() / "replay";
+    std::filesystem::create_directories(dir);
+    bool wrapped = false;
+    while (images.size() < count) {
+      // Start over at the end, unless a whole pass found no usable frame
+      RecordView record;
+      if (!reader.next(RECORD_FRAME, record)) {
+        if (wrapped) {
+          break;
+        }
+        reader.rewind();
+        wrapped = true;
+        continue;
+      }
+      FrameHeader frame;
+      if (!read_frame_header(record, frame)) {
+        std::cerr << "Error: Skipping a malformed frame record" << std::endl;
+        continue;
+      }
+      wrapped = false;
+
+      // Wrap the mapped pixels without copying them
+      cv::Mat img(frame.height, frame.width, frame.mat_type,
+                  record.data + sizeof(frame));
+      std::filesystem::path path =
+          dir / ("frame_" + std::to_string(num_frames++) + ".png");
+      images.emplace_back(img, path);
+    }
+    return images;
+  }
+};
+
+void record_frames(RecordingWriter& recorder,
+                   const std::vector<Image>& images) {
+  for (auto& img : images) {
+    FrameHeader frame{img.mat.cols, img.mat.rows, img.mat.channels(),
+                      img.mat.type()};
+    recorder.append_frame(frame, reinterpret_cast<const char*>(img.mat.data),
+                          img.mat.total() * img.mat.elemSize());
+  }
+}
+
+template <typename Transport>
+bool package_image(Transport& serv, const cv::Mat& img_src,
+                   MyMessage::Image* img_dst, bool downscale) {
+  // Halve the resolution when degraded to cut copy and transfer time
+  cv::Mat img = img_src;
+  if (downscale) {
+    cv::resize(img_src, img, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+  }
+
+  // Hand the image data to the transport, inline or as a shared frame
+  if (!serv.attach_frame(reinterpret_cast<const char*>(img.data),
+                         img.total() * img.elemSize(), img_dst)) {
+    return false;
+  }
+  img_dst->set_width(img.cols);
+  img_dst->set_height(img.rows);
+  img_dst->set_channels(img.channels());
+  return true;
+}
+
+void package_detections(const ImageResult& result,
+                        MyMessage::Reply::Detections* dst) {
+  // Flatten the detected objects into fixed-width rows for columnar packing
+  std::vector<Detection> detections;
+  detections.reserve(result.objs.size());
+  for (auto& obj : result.objs) {
+    detections.push_back({static_cast<uint32_t>(obj.class_id),
+                          clamp_coordinate(obj.xmin),
+                          clamp_coordinate(obj.ymin),
+                          clamp_coordinate(obj.xmax),
+                          clamp_coordinate(obj.ymax), obj.confidence});
+  }
+  pack_detections(detections, dst);
+}
+
+// Images of one capture handed to the transport once and shared by every
+// reply, indexed like the results
+struct PackagedImages {
+  std::vector<MyMessage::Image> images;
+  std::vector<MyMessage::Image> bounding_box_images;
+  bool too_large = false;  // Some image did not fit the transport
+};
+
+template <typename Transport>
+PackagedImages package_images(Transport& serv,
+                              const std::vector<PendingRequest*>& requests,
+                              const std::vector<ImageResult>& img_results,
+                              MyMessage::Reply::Degradation degradation) {
+  bool downscale = degradation >= MyMessage::Reply::LOW_QUALITY;
+  bool annotate = degradation < MyMessage::Reply::NO_ANNOTATION;
+  bool want_image = false;
+  bool want_bounding_box_image = false;
+  for (auto* pending : requests) {
+    want_image |= pending->message.request().get_image();
+    want_bounding_box_image |=
+        annotate && pending->message.request().get_bounding_box_image();
+  }
+
+  PackagedImages packaged;
+  packaged.images.resize(img_results.size());
+  packaged.bounding_box_images.resize(img_results.size());
+  for (size_t i = 0; i < img_results.size(); i++) {
+    if (want_image && !package_image(serv, img_results[i].img.mat,
+                                     &packaged.images[i], downscale)) {
+      packaged.too_large = true;
+    }
+    if (want_bounding_box_image &&
+        !package_image(serv, img_results[i].bbox_img.mat,
+                       &packaged.bounding_box_images[i], downscale)) {
+      packaged.too_large = true;
+    }
+  }
+  if (packaged.too_large) {
+    std::cerr << "Error: Image too large for the transport" << std::endl;
+  }
+  return packaged;
+}
+
+// Copies a packaged image into a reply, or moves it into the last reply of
+// the group so inline TCP pixels are not copied once more
+void give_image(MyMessage::Image& packaged, MyMessage::Image* target,
+                bool last) {
+  if (last) {
+    target->Swap(&packaged);
+  } else {
+    *target = packaged;
+  }
 }
 
 void build_reply(const MyMessage& request, MyMessage& reply,
-                 std::vector<ImageResult>& img_results) {
+                 const std::vector<ImageResult>& img_results,
+                 PackagedImages& packaged, bool last,
+                 const std::vector<std::string>& class_labels,
+                 MyMessage::Reply::Degradation degradation) {
   if (request.command() == MyMessage::REQUEST) {
+    bool annotate = degradation < MyMessage::Reply::NO_ANNOTATION;
     reply.set_id(request.id());
     reply.set_command(MyMessage::REPLY);
-    for (auto& result : img_results) {
-      for (auto& bbox : result.objs) {
-        MyMessage::Reply::BoundingBox* box =
-            reply.mutable_reply()->add_bounding_boxes();
-        box->set_label(std::to_string(bbox.label));
-        box->set_x_min(bbox.xmin);
-        box->set_y_min(bbox.ymin);
-        box->set_x_max(bbox.xmax);
-        box->set_y_max(bbox.ymax);
-        box->set_confidence(bbox.confidence);
+    reply.mutable_reply()->set_degradation(degradation);
+    if (request.request().get_class_table()) {
+      pack_class_table(class_labels, reply.mutable_reply());
+    }
+    if (packaged.too_large) {
+      reply.mutable_reply()->set_status(MyMessage::Reply::FRAME_TOO_LARGE);
+    } else if (img_results.size() < requested_frames(request)) {
+      reply.mutable_reply()->set_status(MyMessage::Reply::TRUNCATED);
+    }
+
+    // One frame block per result, in the order the frames were asked for
+    for (size_t i = 0; i < img_results.size(); i++) {
+      auto& result = img_results[i];
+      auto* frame = reply.mutable_reply()->add_frames();
+      if (static_cast<int>(i) < request.request().camera_ids_size()) {
+        frame->set_camera_id(request.request().camera_ids(i));
+      }
+      package_detections(result, frame->mutable_detections());
+      if (packaged.too_large) {
+        continue;
       }
       if (request.request().get_image()) {
-        package_image(result.img.mat, reply.mutable_reply()->mutable_image());
+        give_image(packaged.images[i], frame->mutable_image(), last);
       }
-      if (request.request().get_bounding_box_image()) {
-        package_image(result.bbox_img.mat,
-                      reply.mutable_reply()->mutable_bounding_box_image());
+      if (request.request().get_bounding_box_image() && annotate) {
+        give_image(packaged.bounding_box_images[i],
+                   frame->mutable_bounding_box_image(), last);
       }
     }
   } else {
@@ -71,40 +269,408 @@ void build_reply(const MyMessage& request, MyMessage& reply,
   }
 }
 
-int main(int argc, char* argv[]) {
-  Server serv(12345);
+struct BoardMetrics {
+  Counter& requests;
+  Counter& frames;
+  Counter& dropped_frames;
+  Counter& bytes_sent;
+  Histogram& capture_latency;
+  Histogram& inference_latency;
+  Histogram& postprocess_latency;
+  Histogram& reply_latency;
+  Histogram& send_latency;
+  Histogram& request_latency;
+  Gauge& dpu_utilization;
+  Gauge& queue_depth;
+  Counter& expired_requests;
+  Counter& coalesced_requests;
+  Gauge& degradation;
+
+  explicit BoardMetrics(MetricsRegistry& registry)
+      : requests(registry.counter("board_requests_total",
+                                  "Requests received from the host")),
+        frames(registry.counter("board_frames_total",
+                                "Frames run through the model")),
+        dropped_frames(registry.counter(
+            "board_dropped_frames_total",
+            "Requests answered without a frame from the camera")),
+        bytes_sent(registry.counter("board_bytes_sent_total",
+                                    "Serialized bytes of sent messages")),
+        capture_latency(registry.histogram("board_stage_latency_seconds",
+                                           "Time spent in each stage",
+                                           "stage=\"capture\"")),
+        inference_latency(registry.histogram("board_stage_latency_seconds",
+                                             "Time spent in each stage",
+                                             "stage=\"inference\"")),
+        postprocess_latency(registry.histogram("board_stage_latency_seconds",
+                                               "Time spent in each stage",
+                                               "stage=\"postprocess\"")),
+        reply_latency(registry.histogram("board_stage_latency_seconds",
+                                         "Time spent in each stage",
+                                         "stage=\"reply\"")),
+        send_latency(registry.histogram("board_stage_latency_seconds",
+                                        "Time spent in each stage",
+                                        "stage=\"send\"")),
+        request_latency(registry.histogram(
+            "board_request_latency_seconds",
+            "Time from receiving a request to sending its reply")),
+        dpu_utilization(registry.gauge(
+            "board_dpu_utilization",
+            "Fraction of time spent in inference since the last request")),
+        queue_depth(registry.gauge("board_request_queue_depth",
+                                   "Requests taken from the queue at once")),
+        expired_requests(registry.counter(
+            "board_expired_requests_total",
+            "Requests dropped because their deadline had passed")),
+        coalesced_requests(registry.counter(
+            "board_coalesced_requests_total",
+            "Requests answered from a frame captured for another request")),
+        degradation(registry.gauge("board_degradation_level",
+                                   "Current degradation level, 0 for full")) {
+  }
+};
+
+struct BoardContext {
+  YoloModel& model;
+  YoloModel* fallback_model = nullptr;
+  double latency_budget = 0.0;
+  const MetricsRegistry& registry;
+  BoardMetrics& metrics;
+  RecordingWriter* recorder = nullptr;
+  ReplayCamera* replay_camera = nullptr;
+};
+
+template <typename Transport>
+void answer_stats(Transport& serv, const MyMessage& request,
+                  const MetricsRegistry& registry, BoardMetrics& metrics) {
+  // Answer metrics snapshots without touching the camera or model
+  MyMessage reply;
+  reply.set_id(request.id());
+  reply.set_command(MyMessage::STATS);
+  registry.snapshot(reply.mutable_stats());
+  serv.send_message(reply);
+  metrics.bytes_sent.inc(reply.ByteSizeLong());
+}
+
+template <typename Transport>
+void answer_sync(Transport& serv, const PendingRequest& request,
+                 BoardMetrics& metrics) {
+  // Receive and send times let the host estimate the clock offset
+  MyMessage reply;
+  reply.set_id(request.message.id());
+  reply.set_command(MyMessage::SYNC);
+  *reply.mutable_timestamps()->mutable_received() = request.received_at;
+  serv.send_message(reply);
+  metrics.bytes_sent.inc(reply.ByteSizeLong());
+}
 
+template <typename Transport>
+void answer_expired(Transport& serv, const PendingRequest& request,
+                    BoardMetrics& metrics) {
+  // Tell the host the request was dropped so it does not wait for frames
+  MyMessage reply;
+  reply.set_id(request.message.id());
+  reply.set_command(MyMessage::REPLY);
+  reply.mutable_reply()->set_status(MyMessage::Reply::DEADLINE_EXCEEDED);
+  *reply.mutable_timestamps()->mutable_received() = request.received_at;
+  serv.send_message(reply);
+  metrics.bytes_sent.inc(reply.ByteSizeLong());
+  metrics.expired_requests.inc();
+}
+
+// Answers the requests whose deadline has passed and keeps the others, so
+// late requests stop costing work between stages
+template <typename Transport>
+void drop_expired(Transport& serv, std::vector<PendingRequest*>& requests,
+                  BoardMetrics& metrics) {
+  auto now = SteadyClock::now();
+  std::vector<PendingRequest*> live;
+  for (auto* pending : requests) {
+    if (pending->expired(now)) {
+      answer_expired(serv, *pending, metrics);
+    } else {
+      live.push_back(pending);
+    }
+  }
+  requests.swap(live);
+}
+
+template <typename Transport>
+float answer_frame_requests(Transport& serv, YoloModel& model,
+                            std::vector<PendingRequest*> requests,
+                            MyMessage::Reply::Degradation degradation,
+                            BoardContext& ctx) {
+  BoardMetrics& metrics = ctx.metrics;
+  Timer stage;
+  MyMessage::Timestamps stages;
+  bool full = degradation == MyMessage::Reply::FULL;
+
+  // Get images from camera, once for all waiting requests, as many as the
+  // transport can carry in one reply
+  const MyMessage& first = requests.front()->message;
+  uint32_t count =
+      std::min(requested_frames(first), serv.max_frames_per_reply());
+  stage.Start();
+  auto images = ctx.replay_camera != nullptr
+                    ? ctx.replay_camera->get_images(count)
+                    : get_camera_images(first, count);
+  stage.Stop();
+  stamp(stages.mutable_captured());
+  metrics.capture_latency.observe(stage.GetDurationInSeconds());
+  if (images.empty()) {
+    metrics.dropped_frames.inc();
+  }
+  metrics.coalesced_requests.inc(requests.size() - 1);
+  if (ctx.recorder != nullptr) {
+    record_frames(*ctx.recorder, images);
+  }
+  drop_expired(serv, requests, metrics);
+  if (requests.empty()) {
+    return 0.f;
+  }
+
+  // Run images as one batch
+  stamp(stages.mutable_inference_start());
+  stage.Start();
+  std::vector<ImageResult> img_results = model.run_images(images);
+  stage.Stop();
+  stamp(stages.mutable_inference_end());
+  float inference_seconds = stage.GetDurationInSeconds();
+  metrics.inference_latency.observe(inference_seconds);
+  metrics.frames.inc(images.size());
+  drop_expired(serv, requests, metrics);
+  if (requests.empty()) {
+    return inference_seconds;
+  }
+
+  // Process results, skipping printing, drawing and saving when degraded,
+  // and hand each image to the transport once for all replies
+  stage.Start();
+  model.process_results(img_results, full, full, full);
+  PackagedImages packaged =
+      package_images(serv, requests, img_results, degradation);
+  stage.Stop();
+  stamp(stages.mutable_postprocessed());
+  metrics.postprocess_latency.observe(stage.GetDurationInSeconds());
+
+  // Send results to each host request
+  for (size_t r = 0; r < requests.size(); r++) {
+    auto* pending = requests[r];
+    MyMessage reply;
+    stage.Start();
+    *reply.mutable_timestamps() = stages;
+    *reply.mutable_timestamps()->mutable_received() = pending->received_at;
+    build_reply(pending->message, reply, img_results, packaged,
+                r + 1 == requests.size(), model.get_class_labels(),
+                degradation);
+    stage.Stop();
+    metrics.reply_latency.observe(stage.GetDurationInSeconds());
+    stage.Start();
+    if (!serv.send_message(reply)) {
+      std::cerr << "Error: Failed to send reply " << reply.id() << std::endl;
+    }
+    stage.Stop();
+    metrics.send_latency.observe(stage.GetDurationInSeconds());
+    metrics.bytes_sent.inc(reply.ByteSizeLong());
+    if (ctx.recorder != nullptr) {
+      ctx.recorder->append_reply(reply);
+    }
+  }
+
+  return inference_seconds;
+}
+
+// Answers one host until it disconnects
+template <typename Transport>
+void serve_connection(Transport& serv, BoardContext& ctx) {
+  BoardMetrics& metrics = ctx.metrics;
+
+  // Queue requests as they arrive so late ones can be dropped or merged
+  RequestQueue queue;
+  std::thread receiver([&serv, &queue, &ctx] {
+    while (true) {
+      MyMessage request;
+      if (!serv.receive_message(request)) {
+        break;
+      }
+      if (ctx.recorder != nullptr) {
+        ctx.recorder->append_message(RECORD_REQUEST, request);
+      }
+      queue.push(std::move(request));
+    }
+    queue.close();
+  });
+
+  MyMessage::Reply::Degradation max_degradation =
+      ctx.fallback_model != nullptr ? MyMessage::Reply::SMALL_MODEL
+                                    : MyMessage::Reply::LOW_QUALITY;
+  DegradationController controller(ctx.latency_budget, max_degradation);
+  auto last_sample = SteadyClock::now();
+  std::vector<PendingRequest> pending;
+  while (queue.pop_all(pending)) {
+    metrics.requests.inc(pending.size());
+    metrics.queue_depth.set(pending.size());
+
+    // Drop requests whose deadline passed while they were queued, and group
+    // the rest by the frames they ask for
+    auto now = SteadyClock::now();
+    std::vector<std::vector<PendingRequest*>> frame_requests;
+    for (auto& request : pending) {
+      if (request.message.command() == MyMessage::STATS) {
+        answer_stats(serv, request.message, ctx.registry, metrics);
+      } else if (request.message.command() == MyMessage::SYNC) {
+        answer_sync(serv, request, metrics);
+      } else if (request.expired(now)) {
+        answer_expired(serv, request, metrics);
+      } else {
+        auto group = std::find_if(
+            frame_requests.begin(), frame_requests.end(),
+            [&request](const std::vector<PendingRequest*>& group) {
+              return same_frames(group.front()->message, request.message);
+            });
+        if (group == frame_requests.end()) {
+          frame_requests.emplace_back();
+          group = frame_requests.end() - 1;
+        }
+        group->push_back(&request);
+      }
+    }
+    if (frame_requests.empty()) {
+      continue;
+    }
+
+    // Answer each group from one capture at the current level
+    float inference_seconds = 0.f;
+    for (auto& group : frame_requests) {
+      MyMessage::Reply::Degradation degradation = controller.level();
+      YoloModel& active_model = degradation >= MyMessage::Reply::SMALL_MODEL
+                                    ? *ctx.fallback_model
+                                    : ctx.model;
+      inference_seconds += answer_frame_requests(serv, active_model, group,
+                                                 degradation, ctx);
+
+      // Latency of the oldest request, including its time in the queue
+      std::chrono::duration<float> latency =
+          SteadyClock::now() - group.front()->received;
+      metrics.request_latency.observe(latency.count());
+      controller.update(latency.count());
+      metrics.degradation.set(controller.level());
+    }
+    now = SteadyClock::now();
+
+    // Inference time over wall time since the previous request completed
+    std::chrono::duration<float> elapsed = now - last_sample;
+    last_sample = now;
+    if (elapsed.count() > 0.f) {
+      metrics.dpu_utilization.set(inference_seconds / elapsed.count());
+    }
+  }
+
+  receiver.join();
+}
+
+template <typename Transport>
+int serve(Transport& serv, BoardContext& ctx) {
   // Start the server
   if (!serv.start()) {
     return EXIT_FAILURE;
   }
 
-  // Load YOLO model
-  YoloModel model("~/code/quant_comp_v5m");
-
-  // Wait for the host to connect
-  if (!serv.accept_connection()) {
-    return EXIT_FAILURE;
+  // Serve hosts one after another, as each connects
+  while (serv.accept_connection()) {
+    serve_connection(serv, ctx);
   }
-  while (true) {
-    // Wait for request from host
-    MyMessage request;
-    serv.receive_message(request);
+  return EXIT_FAILURE;
+}
 
-    // Get images from camera
-    auto images = get_camera_images(request);
+int main(int argc, char* argv[]) {
+  // Serve local clients over shared memory with --shm [name], and metrics on
+  // localhost with --metrics-port <port> (off by default). With
+  // --latency-budget-ms <ms> the board skips work once replies run late,
+  // down to the model given by --fallback-model <path>. Traffic is appended
+  // to a log with --record <file>, and --replay <file> takes camera frames
+  // from such a log instead. Over TCP a reply holds at most --max-frames <n>
+  // frames.
+  bool use_shm = false;
+  std::string shm_name = "/kr260_yolov5";
+  short metrics_port = 0;
+  double latency_budget = 0.0;
+  std::string fallback_path;
+  std::string record_path;
+  std::string replay_path;
+  uint32_t max_frames = Server::kDefaultMaxFrames;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--shm") == 0) {
+      use_shm = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        shm_name = argv[++i];
+      }
+    } else if (std::strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc) {
+      metrics_port = static_cast<short>(std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--latency-budget-ms") == 0 &&
+               i + 1 < argc) {
+      latency_budget = std::atof(argv[++i]) / 1000.0;
+    } else if (std::strcmp(argv[i], "--fallback-model") == 0 && i + 1 < argc) {
+      fallback_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--max-frames") == 0 && i + 1 < argc) {
+      max_frames = std::max(std::atoi(argv[++i]), 1);
+    } else {
+      std::cerr << "Unknown argument: " << argv[i] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
 
-    // Run images
-    std::vector<ImageResult> img_results = model.run_images(images);
+  // Expose metrics for scraping, which the board can do without
+  MetricsRegistry registry;
+  BoardMetrics metrics(registry);
+  MetricsServer metrics_server(registry, metrics_port);
+  if (metrics_port != 0 && !metrics_server.start()) {
+    std::cerr << "Warning: Serving without the metrics endpoint" << std::endl;
+  }
 
-    // Process results
-    model.process_results(img_results, true, true);
+  // Load YOLO model, and the smaller one to fall back to under overload
+  YoloModel model("~/code/quant_comp_v5m");
+  std::unique_ptr<YoloModel> fallback_model;
+  if (!fallback_path.empty()) {
+    fallback_model = std::make_unique<YoloModel>(fallback_path);
+    if (!fallback_model->is_loaded()) {
+      std::cerr << "Error: Failed to load fallback model " << fallback_path
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    // Hosts cache one class table, so both models must share it
+    if (fallback_model->get_class_labels() != model.get_class_labels()) {
+      std::cerr << "Error: Fallback model " << fallback_path
+                << " has different class labels" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
 
-    // Send results to host
-    MyMessage reply;
-    build_reply(request, reply, img_results);
-    serv.send_message(reply);
+  // Open the traffic log and the recording to replay frames from
+  RecordingWriter recorder;
+  if (!record_path.empty() && !recorder.open(record_path)) {
+    return EXIT_FAILURE;
+  }
+  ReplayCamera replay_camera;
+  if (!replay_path.empty() && !replay_camera.reader.open(replay_path)) {
+    return EXIT_FAILURE;
   }
 
-  return EXIT_SUCCESS;
+  BoardContext ctx{model,
+                   fallback_model.get(),
+                   latency_budget,
+                   registry,
+                   metrics,
+                   record_path.empty() ? nullptr : &recorder,
+                   replay_path.empty() ? nullptr : &replay_camera};
+  if (use_shm) {
+    SharedMemoryServer serv(shm_name);
+    return serve(serv, ctx);
+  }
+  Server serv(12345, max_frames);
+  return serve(serv, ctx);
 }
@@ -0,0 +1,404 @@
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <regex>
+
+#include "YoloModel.hpp"
+
+// Runs a labeled image set through every model variant and threshold pair
+// and prints accuracy next to latency, to choose what to deploy for a given
+// latency budget. Labels are YOLO text files: one "class cx cy w h" line per
+// object with coordinates normalized to the image size, stored next to the
+// images or in a sibling labels/ directory with the same file stem.
+
+struct Box {
+  int class_id;
+  float xmin;
+  float ymin;
+  float xmax;
+  float ymax;
+};
+
+struct ScoredBox {
+  Box box;
+  float confidence;
+  size_t image;
+};
+
+struct Thresholds {
+  float conf;
+  float nms;
+};
+
+struct EvalRow {
+  std::string variant;
+  Thresholds thresholds;
+  double map;
+  double precision;
+  double recall;
+  size_t batch_size;
+  double p50_ms;
+  double p90_ms;
+  double p99_ms;
+  double fps;
+};
+
+std::vector<Box> load_labels(const Image& img) {
+  std::vector<Box> boxes;
+  std::filesystem::path name = img.path.stem().string() + ".txt";
+  std::filesystem::path label_path = img.path.parent_path() / name;
+  if (!std::filesystem::exists(label_path)) {
+    label_path = img.path.parent_path().parent_path() / "labels" / name;
+  }
+  std::ifstream file(label_path);
+  if (!file) {
+    std::cerr << "Missing labels for " << img.path.filename() << std::endl;
+    return boxes;
+  }
+
+  // Convert normalized centers and sizes to pixel corners
+  int class_id;
+  float cx, cy, w, h;
+  while (file >> class_id >> cx >> cy >> w >> h) {
+    boxes.push_back({class_id, (cx - w / 2) * img.mat.cols,
+                     (cy - h / 2) * img.mat.rows, (cx + w / 2) * img.mat.cols,
+                     (cy + h / 2) * img.mat.rows});
+  }
+  return boxes;
+}
+
+float iou(const Box& a, const Box& b) {
+  float w = std::min(a.xmax, b.xmax) - std::max(a.xmin, b.xmin);
+  float h = std::min(a.ymax, b.ymax) - std::max(a.ymin, b.ymin);
+  if (w <= 0.f || h <= 0.f) return 0.f;
+  float inter = w * h;
+  float area_a = (a.xmax - a.xmin) * (a.ymax - a.ymin);
+  float area_b = (b.xmax - b.xmin) * (b.ymax - b.ymin);
+  return inter / (area_a + area_b - inter);
+}
+
+// Area under the precision-recall curve with all-point interpolation
+double average_precision(std::vector<double> recall,
+                         std::vector<double> precision) {
+  recall.insert(recall.begin(), 0.0);
+  recall.push_back(1.0);
+  precision.insert(precision.begin(), 0.0);
+  precision.push_back(0.0);
+  for (size_t i = precision.size() - 1; i > 0; i--) {
+    precision[i - 1] = std::max(precision[i - 1], precision[i]);
+  }
+  double ap = 0.0;
+  for (size_t i = 1; i < recall.size(); i++) {
+    ap += (recall[i] - recall[i - 1]) * precision[i];
+  }
+  return ap;
+}
+
+// Matches detections to ground truth greedily by confidence, per class
+void score(const std::vector<ScoredBox>& detections,
+           const std::vector<std::vector<Box>>& ground_truth,
+           float iou_threshold, EvalRow& row) {
+  std::map<int, size_t> num_truth;
+  for (auto& boxes : ground_truth) {
+    for (auto& box : boxes) num_truth[box.class_id]++;
+  }
+
+  double sum_ap = 0.0;
+  size_t true_positives = 0;
+  for (auto& [class_id, class_truth] : num_truth) {
+    std::vector<ScoredBox> class_dets;
+    for (auto& det : detections) {
+      if (det.box.class_id == class_id) class_dets.push_back(det);
+    }
+    std::sort(class_dets.begin(), class_dets.end(),
+              [](const ScoredBox& a, const ScoredBox& b) {
+                return a.confidence > b.confidence;
+              });
+
+    std::vector<std::vector<bool>> matched(ground_truth.size());
+    for (size_t i = 0; i < ground_truth.size(); i++) {
+      matched[i].resize(ground_truth[i].size(), false);
+    }
+    std::vector<double> recall, precision;
+    size_t tp = 0;
+    for (size_t n = 0; n < class_dets.size(); n++) {
+      auto& det = class_dets[n];
+      auto& truth = ground_truth[det.image];
+      float best_iou = iou_threshold;
+      int best = -1;
+      for (size_t j = 0; j < truth.size(); j++) {
+        if (truth[j].class_id != class_id || matched[det.image][j]) continue;
+        float overlap = iou(det.box, truth[j]);
+        if (overlap >= best_iou) {
+          best_iou = overlap;
+          best = j;
+        }
+      }
+      if (best >= 0) {
+        matched[det.image][best] = true;
+        tp++;
+      }
+      recall.push_back(static_cast<double>(tp) / class_truth);
+      precision.push_back(static_cast<double>(tp) / (n + 1));
+    }
+    sum_ap += average_precision(recall, precision);
+    true_positives += tp;
+  }
+
+  size_t total_truth = 0;
+  for (auto& [class_id, count] : num_truth) total_truth += count;
+  row.map = num_truth.empty() ? 0.0 : sum_ap / num_truth.size();
+  row.precision = detections.empty()
+                      ? 0.0
+                      : static_cast<double>(true_positives) / detections.size();
+  row.recall = total_truth == 0
+                   ? 0.0
+                   : static_cast<double>(true_positives) / total_truth;
+}
+
+double percentile(std::vector<double> sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  std::sort(sorted.begin(), sorted.end());
+  return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+}
+
+// Copies a variant into its own model directory with the thresholds written
+// into the prototxt, since the Vitis AI model reads them from there. The
+// directory name is the model name, so thresholds are encoded in percent.
+// YoloModel copies the model once more into the working directory, which is
+// why evaluation runs from inside the staging root.
+std::filesystem::path stage_variant(const std::filesystem::path& model_dir,
+                                    const std::string& variant,
+                                    const Thresholds& thresholds,
+                                    const std::filesystem::path& stage_root) {
+  std::string base = model_dir.filename().string();
+  std::string name = variant + "_c" +
+                     std::to_string(std::lround(thresholds.conf * 100)) +
+                     "_n" + std::to_string(std::lround(thresholds.nms * 100));
+  std::filesystem::path dir = stage_root / name;
+  std::filesystem::create_directories(dir);
+
+  // Use the variant's own prototxt when it has one
+  std::filesystem::path prototxt = model_dir / (variant + ".prototxt");
+  if (!std::filesystem::exists(prototxt)) {
+    prototxt = model_dir / (base + ".prototxt");
+  }
+  std::ifstream in(prototxt);
+  std::stringstream config;
+  config << in.rdbuf();
+  std::string text = config.str();
+  text = std::regex_replace(text, std::regex("conf_threshold: *[0-9.]+"),
+                            "conf_threshold: " +
+                                std::to_string(thresholds.conf));
+  text = std::regex_replace(text, std::regex("nms_threshold: *[0-9.]+"),
+                            "nms_threshold: " + std::to_string(thresholds.nms));
+  std::ofstream(dir / (name + ".prototxt")) << text;
+
+  std::filesystem::copy_file(model_dir / (variant + ".xmodel"),
+                             dir / (name + ".xmodel"),
+                             std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::copy_file(model_dir / (base + ".classcsv"),
+                             dir / (name + ".classcsv"),
+                             std::filesystem::copy_options::overwrite_existing);
+  return dir;
+}
+
+bool evaluate(const std::filesystem::path& model_dir,
+              const std::string& variant, const Thresholds& thresholds,
+              std::vector<Image>& images,
+              const std::vector<std::vector<Box>>& ground_truth,
+              float iou_threshold, const std::filesystem::path& stage_root,
+              EvalRow& row) {
+  std::filesystem::path dir =
+      stage_variant(model_dir, variant, thresholds, stage_root / "variants");
+  YoloModel model(dir.string());
+  if (!model.is_loaded()) {
+    return false;
+  }
+
+  // Run images in small chunks to bound the memory held by results
+  constexpr size_t kChunkSize = 16;
+
+  // Warm up the DPU so its first run does not land in the percentiles
+  std::vector<Image> warmup(
+      images.begin(), images.begin() + std::min(kChunkSize, images.size()));
+  model.run_images(warmup);
+
+  // Latency is taken per batch, as that is how long each image waits for
+  // its results, while throughput counts every image
+  std::vector<ScoredBox> detections;
+  std::vector<double> latencies_ms;
+  double total_seconds = 0.0;
+  row.batch_size = 1;
+  for (size_t start = 0; start < images.size(); start += kChunkSize) {
+    size_t end = std::min(start + kChunkSize, images.size());
+    std::vector<Image> chunk(images.begin() + start, images.begin() + end);
+    std::vector<ImageResult> img_results = model.run_images(chunk);
+    for (size_t i = 0; i < img_results.size();
+         i += std::max<size_t>(img_results[i].batch_size, 1)) {
+      latencies_ms.push_back(img_results[i].batch_seconds * 1e3);
+      total_seconds += img_results[i].batch_seconds;
+      row.batch_size = std::max(row.batch_size, img_results[i].batch_size);
+    }
+    for (size_t i = 0; i < img_results.size(); i++) {
+      for (auto& obj : img_results[i].objs) {
+        detections.push_back({{obj.class_id, obj.xmin, obj.ymin, obj.xmax,
+                               obj.ymax},
+                              obj.confidence,
+                              start + i});
+      }
+    }
+  }
+
+  row.variant = variant;
+  row.thresholds = thresholds;
+  score(detections, ground_truth, iou_threshold, row);
+  row.p50_ms = percentile(latencies_ms, 0.5);
+  row.p90_ms = percentile(latencies_ms, 0.9);
+  row.p99_ms = percentile(latencies_ms, 0.99);
+  row.fps = total_seconds > 0.0 ? images.size() / total_seconds : 0.0;
+
+  // Remove the copies made for this run, all within the staging root
+  std::filesystem::remove_all(dir);
+  std::filesystem::remove_all(stage_root / dir.filename());
+  return true;
+}
+
+void print_table(const std::vector<EvalRow>& rows, float iou_threshold) {
+  std::cout << std::endl
+            << std::left << std::setw(28) << "variant" << std::right
+            << std::setw(6) << "conf" << std::setw(6) << "nms" << std::setw(9)
+            << "mAP@" + std::to_string(iou_threshold).substr(0, 4)
+            << std::setw(10) << "precision" << std::setw(8) << "recall"
+            << std::setw(7) << "batch" << std::setw(9) << "p50 ms"
+            << std::setw(9) << "p90 ms" << std::setw(9) << "p99 ms"
+            << std::setw(8) << "fps" << std::endl;
+  std::cout << std::fixed;
+  for (auto& row : rows) {
+    std::cout << std::left << std::setw(28) << row.variant << std::right
+              << std::setprecision(2) << std::setw(6) << row.thresholds.conf
+              << std::setw(6) << row.thresholds.nms << std::setprecision(3)
+              << std::setw(9) << row.map << std::setw(10) << row.precision
+              << std::setw(8) << row.recall << std::setw(7) << row.batch_size
+              << std::setprecision(1) << std::setw(9) << row.p50_ms
+              << std::setw(9) << row.p90_ms << std::setw(9) << row.p99_ms
+              << std::setw(8) << row.fps << std::endl;
+  }
+}
+
+std::vector<std::string> split(const std::string& text, char delimiter) {
+  std::vector<std::string> parts;
+  std::istringstream ss(text);
+  std::string part;
+  while (std::getline(ss, part, delimiter)) {
+    if (!part.empty()) parts.push_back(part);
+  }
+  return parts;
+}
+
+int main(int argc, char* argv[]) {
+  std::string images_path = "~/code/shiprs_test_images";
+  std::string model_path = "~/code/quant_comp_v5m";
+  std::vector<std::string> variants;
+  std::vector<Thresholds> thresholds = {{0.25f, 0.45f}, {0.1f, 0.1f}};
+  float iou_threshold = 0.5f;
+  std::string csv_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--model-dir" && i + 1 < argc) {
+      model_path = argv[++i];
+    } else if (arg == "--variants" && i + 1 < argc) {
+      variants = split(argv[++i], ',');
+    } else if (arg == "--thresholds" && i + 1 < argc) {
+      // Pairs of conf:nms separated by commas, e.g. 0.25:0.45,0.1:0.1
+      thresholds.clear();
+      for (auto& pair : split(argv[++i], ',')) {
+        auto values = split(pair, ':');
+        if (values.size() != 2) {
+          std::cerr << "Invalid threshold pair: " << pair << std::endl;
+          return EXIT_FAILURE;
+        }
+        thresholds.push_back({std::stof(values[0]), std::stof(values[1])});
+      }
+    } else if (arg == "--iou" && i + 1 < argc) {
+      iou_threshold = std::stof(argv[++i]);
+    } else if (arg == "--csv" && i + 1 < argc) {
+      csv_path = argv[++i];
+    } else if (arg[0] != '-') {
+      images_path = arg;
+    } else {
+      std::cerr << "Unknown argument: " << arg << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Evaluate every xmodel in the model directory unless told otherwise
+  std::filesystem::path model_dir = model_path;
+  if (!model_path.empty() && model_path[0] == '~') {
+    model_dir = std::getenv("HOME") + model_path.substr(1);
+  }
+  model_dir = std::filesystem::absolute(model_dir);
+  if (variants.empty()) {
+    for (auto& entry : std::filesystem::directory_iterator(model_dir)) {
+      if (entry.path().extension() == ".xmodel") {
+        variants.push_back(entry.path().stem().string());
+      }
+    }
+    std::sort(variants.begin(), variants.end());
+  }
+
+  // Load images and their ground truth once for all runs
+  std::vector<Image> images = YoloModel::load_images(images_path);
+  if (images.empty()) {
+    return EXIT_FAILURE;
+  }
+  std::vector<std::vector<Box>> ground_truth;
+  for (auto& img : images) {
+    ground_truth.push_back(load_labels(img));
+  }
+
+  // Stage variants in a fresh directory and work from there, so the model
+  // copies never touch existing files and can all be removed at the end
+  std::string stage_template =
+      (std::filesystem::temp_directory_path() / "eval_models.XXXXXX")
+          .string();
+  if (mkdtemp(stage_template.data()) == nullptr) {
+    std::cerr << "Failed to create a staging directory" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::filesystem::path stage_root = stage_template;
+  std::filesystem::path original_dir = std::filesystem::current_path();
+  std::filesystem::current_path(stage_root);
+
+  std::vector<EvalRow> rows;
+  for (auto& variant : variants) {
+    for (auto& pair : thresholds) {
+      EvalRow row;
+      if (evaluate(model_dir, variant, pair, images, ground_truth,
+                   iou_threshold, stage_root, row)) {
+        rows.push_back(row);
+      } else {
+        std::cerr << "Failed to load variant " << variant << std::endl;
+      }
+    }
+  }
+  std::filesystem::current_path(original_dir);
+  std::filesystem::remove_all(stage_root);
+
+  print_table(rows, iou_threshold);
+  if (!csv_path.empty()) {
+    std::ofstream csv(csv_path);
+    csv << "variant,conf,nms,map,precision,recall,batch,p50_ms,p90_ms,p99_ms,"
+           "fps\n";
+    for (auto& row : rows) {
+      csv << row.variant << "," << row.thresholds.conf << ","
+          << row.thresholds.nms << "," << row.map << "," << row.precision
+          << "," << row.recall << "," << row.batch_size << ","
+          << row.p50_ms << "," << row.p90_ms << "," << row.p99_ms << ","
+          << row.fps << "\n";
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,17 +1,21 @@
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <opencv2/opencv.hpp>
 #include <random>
+#include <sstream>
 #include <thread>
 #include <vector>
 
+#include "Client.hpp"
+#include "Detections.hpp"
+#include "Latency.hpp"
+#include "Recording.hpp"
+#include "SharedMemory.hpp"
 #include "message.pb.h"
 
 struct RandomGenerator {
@@ -30,67 +34,60 @@ struct RandomGenerator {
   }
 };
 
-double secondsSinceEpoch() {
-  // get the current time
-  std::time_t current_time = std::time(nullptr);
-
-  // convert to seconds since the epoch
-  return std::difftime(current_time, 0);
-}
-
-bool sendMessage(MyMessage &message, int sockfd) {
-  // Serialize the message to a byte array
-  message.set_time_sent(secondsSinceEpoch());
-  size_t size = message.ByteSizeLong();
-  char messageData[size];
-  message.SerializeToArray(messageData, size);
-
-  // Send the message to the socket
-  ssize_t numSent = send(sockfd, messageData, size, 0);
-  if (numSent == -1) {
-    std::cerr << "Error: Failed to send message" << std::endl;
-    return false;
-  }
-  return true;
-}
-
-bool receiveMessage(MyMessage &message, int sockfd) {
-  // Read size of data from the socket
-  size_t size;
-  ssize_t numRecv = recv(sockfd, &size, sizeof(size), 0);
-  if (numRecv == -1) {
-    std::cerr << "Error: Failed to receive size of message" << std::endl;
-    return false;
-  }
+struct HostOptions {
+  int stats_every = 0;
+  uint32_t deadline_ms = 0;
+  int sync_rounds = 0;
+  std::string record_path;
+  uint32_t num_frames = 0;
+  std::vector<uint32_t> camera_ids;
+};
 
-  // Read the message data from the socket
-  char *buffer = (char *)malloc(size);
-  size_t bytesReceived = 0;
-  while (bytesReceived < size) {
-    numRecv = recv(sockfd, buffer + bytesReceived, size - bytesReceived, 0);
-    if (numRecv == -1) {
-      std::cerr << "Error: Failed to receive message" << std::endl;
-      free(buffer);
+// Estimates the board clock offset from the SYNC exchange with the smallest
+// round trip, which bounds the error by half of that round trip
+template <typename Transport>
+bool estimate_clock_offset(Transport &client, int rounds,
+                           LatencyTracker &tracker) {
+  int64_t best_round_trip = INT64_MAX;
+  for (int i = 0; i < rounds; i++) {
+    MyMessage request;
+    request.set_command(MyMessage::SYNC);
+    request.set_id(-1 - i);
+    int64_t t0 = wallNanoseconds();
+    if (!client.send_message(request)) {
       return false;
     }
-    bytesReceived += numRecv;
+    MyMessage reply;
+    if (!client.receive_reply(request.id(), reply)) {
+      return false;
+    }
+    int64_t t3 = wallNanoseconds();
+    if (reply.command() != MyMessage::SYNC) {
+      std::cerr << "Error: Unexpected reply to sync request" << std::endl;
+      continue;
+    }
+    int64_t t1 = reply.timestamps().received().wall_ns();
+    int64_t t2 = reply.timestamps().sent().wall_ns();
+    int64_t round_trip = (t3 - t0) - (t2 - t1);
+    if (round_trip < best_round_trip) {
+      best_round_trip = round_trip;
+      tracker.clock_offset_ns = ((t1 - t0) + (t2 - t3)) / 2;
+      tracker.has_offset = true;
+    }
   }
-
-  // Parse the message from the received data
-  if (!message.ParseFromArray(buffer, size)) {
-    free(buffer);
-    std::cerr << "Error: Failed to parse message" << std::endl;
-    return false;
+  if (tracker.has_offset) {
+    std::cout << "Clock offset: " << tracker.clock_offset_ns / 1e6
+              << " ms (+/- " << best_round_trip / 2e6 << " ms)" << std::endl;
   }
-  free(buffer);
   return true;
 }
 
 // Function to save a MyImage message to a file
-void save_image(const std::string &filename, const MyMessage_Image &image) {
-  // Convert the image data to a cv::Mat
-  cv::Mat img(image.height(), image.width(), CV_8UC(image.channels()));
-  std::memcpy(img.data, image.data().data(), image.data().size());
+void save_image(const std::string &filename, const MyMessage_Image &image,
+                std::string_view data) {
+  // Wrap the image data in a cv::Mat without copying it
+  cv::Mat img(image.height(), image.width(), CV_8UC(image.channels()),
+              const_cast<char *>(data.data()));
 
   // Encode the image to a JPEG file
   std::vector<uint8_t> buffer;
@@ -99,30 +96,97 @@ void save_image(const std::string &filename, const MyMessage_Image &image) {
   file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
 }
 
-int main(int argc, char *argv[]) {
-  std::string board_ip = "10.0.40.40";
-  short board_port = 12345;
+// Bytes of pixels an image message describes
+size_t image_size(const MyMessage_Image &image) {
+  return static_cast<size_t>(image.width()) * image.height() *
+         image.channels();
+}
 
-  // Create a TCP socket to connect to the remote device
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd == -1) {
-    std::cerr << "Error: Failed to create socket" << std::endl;
+// Saves an image read through the transport, which fails for a shared-memory
+// frame that was overwritten before or while it was read
+template <typename Transport>
+void save_frame_image(Transport &client, const std::string &filename,
+                      const MyMessage_Image &image) {
+  std::string_view data = client.image_data(image);
+  if (data.size() != image_size(image)) {
+    std::cerr << "Error: Image " << filename << " was overwritten"
+              << std::endl;
+    return;
+  }
+  save_image(filename, image, data);
+  if (!client.image_intact(image)) {
+    std::cerr << "Error: Image " << filename
+              << " was overwritten while saving" << std::endl;
+  }
+}
+
+// Appends the camera images of a reply as frame records, so a recording made
+// on the host can feed `board --replay` too
+template <typename Transport>
+void record_reply_frames(RecordingWriter &recorder, Transport &client,
+                         const MyMessage &reply) {
+  for (const auto &frame : reply.reply().frames()) {
+    if (!frame.has_image()) {
+      continue;
+    }
+    const auto &image = frame.image();
+    std::string_view data = client.image_data(image);
+    if (data.size() != image_size(image)) {
+      continue;
+    }
+    FrameHeader header{static_cast<int32_t>(image.width()),
+                       static_cast<int32_t>(image.height()),
+                       static_cast<int32_t>(image.channels()),
+                       CV_8UC(image.channels())};
+    recorder.append_frame(header, data.data(), data.size());
+  }
+}
+
+template <typename Transport>
+bool print_stats(Transport &client, int id) {
+  // Ask the board for a snapshot of its metrics
+  MyMessage request;
+  request.set_command(MyMessage::STATS);
+  request.set_id(id);
+  if (!client.send_message(request)) {
+    return false;
+  }
+
+  MyMessage reply;
+  if (!client.receive_reply(id, reply)) {
+    return false;
+  }
+  if (reply.command() != MyMessage::STATS) {
+    std::cerr << "Error: Unexpected reply to stats request" << std::endl;
+    return true;
+  }
+  std::cout << "Board stats:" << std::endl;
+  for (const auto &metric : reply.stats().metrics()) {
+    std::cout << "  " << metric.name() << " " << metric.value() << std::endl;
+  }
+  return true;
+}
+
+template <typename Transport>
+int run_client(Transport &client, const HostOptions &options) {
+  if (!client.connect_to_server()) {
     return 1;
   }
 
-  // Connect to the remote device
-  struct sockaddr_in remoteAddr {};
-  memset(&remoteAddr, 0, sizeof(remoteAddr));
-  remoteAddr.sin_family = AF_INET;
-  remoteAddr.sin_addr.s_addr = inet_addr(board_ip.c_str());
-  remoteAddr.sin_port = htons(board_port);
-  if (connect(sockfd, (struct sockaddr *)&remoteAddr, sizeof(remoteAddr)) ==
-      -1) {
-    std::cerr << "Error: Failed to connect to remote device" << std::endl;
+  RecordingWriter recorder;
+  bool recording = !options.record_path.empty();
+  if (recording && !recorder.open(options.record_path)) {
+    return 1;
+  }
+
+  LatencyTracker latency;
+  if (options.sync_rounds > 0 &&
+      !estimate_clock_offset(client, options.sync_rounds, latency)) {
     return 1;
   }
 
   RandomGenerator rng;
+  std::vector<std::string> class_table;
   for (int id = 0;; id++) {
     // Create a message to send to the board
     MyMessage request;
@@ -131,49 +195,122 @@ int main(int argc, char *argv[]) {
     request.set_id(id);
     request.mutable_request()->set_get_image(true);
     request.mutable_request()->set_get_bounding_box_image(true);
+    request.mutable_request()->set_get_class_table(class_table.empty());
+    request.mutable_request()->set_deadline_ms(options.deadline_ms);
+    request.mutable_request()->set_num_frames(options.num_frames);
+    for (uint32_t camera_id : options.camera_ids) {
+      request.mutable_request()->add_camera_ids(camera_id);
+    }
 
     // Send the request to the board
-    if (!sendMessage(request, sockfd)) {
+    int64_t sent_mono = monotonicNanoseconds();
+    int64_t sent_wall = wallNanoseconds();
+    if (!client.send_message(request)) {
       break;
     }
+    if (recording) {
+      recorder.append_message(RECORD_REQUEST, request);
+    }
     std::cout << "Sent request: " << request.id() << std::endl;
 
     // Wait for a reply from the board
     MyMessage reply;
-    if (!receiveMessage(reply, sockfd)) {
+    if (!client.receive_reply(request.id(), reply)) {
       break;
     }
+    int64_t received_mono = monotonicNanoseconds();
+    int64_t received_wall = wallNanoseconds();
+    if (recording) {
+      record_reply_frames(recorder, client, reply);
+      recorder.append_reply(reply);
+    }
     std::cout << "Received reply: " << reply.id() << std::endl;
+    if (reply.has_timestamps()) {
+      latency.add(reply.timestamps(), sent_mono, received_mono, sent_wall,
+                  received_wall);
+      latency.print();
+    }
     // Process the reply
-    if (reply.command() == MyMessage::REPLY) {
+    if (reply.command() == MyMessage::REPLY &&
+        reply.reply().status() == MyMessage::Reply::DEADLINE_EXCEEDED) {
+      std::cerr << "Board dropped request " << reply.id()
+                << " after its deadline" << std::endl;
+    } else if (reply.command() == MyMessage::REPLY) {
       std::cout << "Time sent: " << reply.time_sent() << std::endl;
-      for (const auto &box : reply.reply().bounding_boxes()) {
-        std::cout << "label: " << box.label() << ", x_min: " << box.x_min()
-                  << ", y_min: " << box.y_min() << ", x_max: " << box.x_max()
-                  << ", y_max: " << box.y_max()
-                  << ", confidence: " << box.confidence() << std::endl;
+      if (reply.reply().degradation() != MyMessage::Reply::FULL) {
+        std::cout << "Degraded: "
+                  << MyMessage::Reply::Degradation_Name(
+                         reply.reply().degradation())
+                  << std::endl;
       }
-      if (request.request().get_image()) {
-        if (reply.reply().has_image()) {
-          save_image(std::to_string(reply.id()) + ".jpg",
-                     reply.reply().image());
-        } else {
-          std::cerr << "Error: Missing requested image" << std::endl;
-        }
+      bool images_sent =
+          reply.reply().status() != MyMessage::Reply::FRAME_TOO_LARGE;
+      if (reply.reply().status() == MyMessage::Reply::FRAME_TOO_LARGE) {
+        std::cerr << "Error: Board could not send images this large"
+                  << std::endl;
+      } else if (reply.reply().status() == MyMessage::Reply::TRUNCATED) {
+        std::cerr << "Board sent " << reply.reply().frames_size()
+                  << " frame(s), fewer than requested" << std::endl;
+      }
+      if (reply.reply().class_table_size() > 0) {
+        class_table.assign(reply.reply().class_table().begin(),
+                           reply.reply().class_table().end());
+      }
+      if (reply.reply().frames_size() == 0) {
+        std::cerr << "Error: No frames in reply" << std::endl;
       }
-      if (request.request().get_bounding_box_image()) {
-        if (reply.reply().has_bounding_box_image()) {
-          save_image(std::to_string(reply.id()) + "_bbox.jpg",
-                     reply.reply().bounding_box_image());
-        } else {
-          std::cerr << "Error: Missing requested bounding box image"
-                    << std::endl;
+      for (int i = 0; i < reply.reply().frames_size(); i++) {
+        const auto &frame = reply.reply().frames(i);
+        std::cout << "Frame " << i << " (camera " << frame.camera_id()
+                  << "):" << std::endl;
+        std::vector<Detection> detections;
+        if (!unpack_detections(frame.detections(), detections)) {
+          std::cerr << "Error: Malformed detections" << std::endl;
+        }
+        for (const auto &det : detections) {
+          std::string label = det.class_id < class_table.size()
+                                  ? class_table[det.class_id]
+                                  : std::to_string(det.class_id);
+          std::cout << "label: " << label << ", x_min: " << det.x_min
+                    << ", y_min: " << det.y_min << ", x_max: " << det.x_max
+                    << ", y_max: " << det.y_max
+                    << ", confidence: " << det.confidence << std::endl;
+        }
+
+        // Name single-frame images by request id alone, as before batching
+        std::string name = std::to_string(reply.id());
+        if (reply.reply().frames_size() > 1) {
+          name += "_" + std::to_string(i);
+        }
+        if (request.request().get_image()) {
+          if (frame.has_image()) {
+            save_frame_image(client, name + ".jpg", frame.image());
+          } else if (images_sent) {
+            std::cerr << "Error: Missing requested image" << std::endl;
+          }
+        }
+        if (request.request().get_bounding_box_image()) {
+          if (frame.has_bounding_box_image()) {
+            save_frame_image(client, name + "_bbox.jpg",
+                             frame.bounding_box_image());
+          } else if (images_sent &&
+                     reply.reply().degradation() == MyMessage::Reply::FULL) {
+            std::cerr << "Error: Missing requested bounding box image"
+                      << std::endl;
+          }
         }
       }
     } else {
       std::cerr << "Error: Unsupported command" << std::endl;
     }
 
+    // Poll the board metrics every stats_every requests
+    if (options.stats_every > 0 && (id + 1) % options.stats_every == 0) {
+      if (!print_stats(client, id)) {
+        break;
+      }
+    }
+
     // Sleep for 5 to 20 seconds
     unsigned int seconds = rng.next_in_range(5, 20);
     std::cout << "Sleeping for " << seconds << " seconds..." << std::endl;
@@ -181,8 +318,54 @@ int main(int argc, char *argv[]) {
     std::cout << "Done sleeping." << std::endl;
   }
 
-  // Close the socket
-  close(sockfd);
-
   return 0;
 }
+
+int main(int argc, char *argv[]) {
+  // Attach to a board process on this machine with --shm [name], print
+  // board metrics every N requests with --stats-every N, give each request a
+  // time budget with --deadline-ms <ms>, and estimate the board clock offset
+  // from N exchanges with --sync N. Requests and replies are appended to a
+  // log with --record <file>. Each request asks for N frames with
+  // --frames N, or for one frame from each camera with --cameras <id,...>.
+  bool use_shm = false;
+  std::string shm_name = "/kr260_yolov5";
+  HostOptions options;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--shm") == 0) {
+      use_shm = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        shm_name = argv[++i];
+      }
+    } else if (std::strcmp(argv[i], "--stats-every") == 0 && i + 1 < argc) {
+      options.stats_every = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--deadline-ms") == 0 && i + 1 < argc) {
+      options.deadline_ms = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--sync") == 0 && i + 1 < argc) {
+      options.sync_rounds = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      options.record_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      options.num_frames = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--cameras") == 0 && i + 1 < argc) {
+      std::stringstream ids(argv[++i]);
+      std::string id;
+      while (std::getline(ids, id, ',')) {
+        options.camera_ids.push_back(static_cast<uint32_t>(std::stoul(id)));
+      }
+    } else {
+      std::cerr << "Unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  if (use_shm) {
+    SharedMemoryClient client(shm_name);
+    return run_client(client, options);
+  }
+
+  std::string board_ip = "10.0.40.40";
+  short board_port = 12345;
+  Client client(board_ip, board_port);
+  return run_client(client, options);
+}
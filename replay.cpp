@@ -0,0 +1,154 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+
+#include "Client.hpp"
+#include "Latency.hpp"
+#include "Recording.hpp"
+#include "SharedMemory.hpp"
+#include "message.pb.h"
+
+// Detections over all frames of a reply
+int count_detections(const MyMessage &reply) {
+  int count = 0;
+  for (const auto &frame : reply.reply().frames()) {
+    count += frame.detections().class_ids_size();
+  }
+  return count;
+}
+
+// Sends the requests of a recording to a board, keeping their original
+// spacing divided by speed, and compares the replies with the recorded ones.
+// Pair it with `board --replay <file>` so the board sees the recorded frames.
+template <typename Transport>
+int replay(Transport &client, RecordingReader &reader, double speed) {
+  if (!client.connect_to_server()) {
+    return EXIT_FAILURE;
+  }
+
+  // Index the recorded detection counts by request id
+  std::unordered_map<int32_t, int> recorded_detections;
+  RecordView record;
+  while (reader.next(RECORD_REPLY, record)) {
+    MyMessage reply;
+    if (reply.ParseFromArray(record.data, record.size) &&
+        reply.command() == MyMessage::REPLY &&
+        reply.reply().status() == MyMessage::Reply::OK) {
+      recorded_detections[reply.id()] = count_detections(reply);
+    }
+  }
+  reader.rewind();
+
+  LatencySeries round_trip("round trip");
+  int num_sent = 0;
+  int num_expired = 0;
+  int num_compared = 0;
+  int num_matched = 0;
+  int64_t previous_recorded = -1;
+  int64_t due = monotonicNanoseconds();
+  int64_t start = due;
+  while (reader.next(RECORD_REQUEST, record)) {
+    MyMessage request;
+    if (!request.ParseFromArray(record.data, record.size)) {
+      std::cerr << "Error: Failed to parse recorded request" << std::endl;
+      continue;
+    }
+
+    // Keep the recorded gap to the previous request, scaled by speed. Gaps
+    // going backwards, as between two recording sessions, are dropped.
+    if (previous_recorded >= 0 && speed > 0.0) {
+      int64_t gap = record.monotonic_ns - previous_recorded;
+      due += gap > 0 ? static_cast<int64_t>(gap / speed) : 0;
+      int64_t wait = due - monotonicNanoseconds();
+      if (wait > 0) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+      }
+    }
+    previous_recorded = record.monotonic_ns;
+
+    // Replay the request and wait for its reply
+    int64_t sent_at = monotonicNanoseconds();
+    if (!client.send_message(request)) {
+      break;
+    }
+    MyMessage reply;
+    if (!client.receive_reply(request.id(), reply)) {
+      break;
+    }
+    round_trip.add(monotonicNanoseconds() - sent_at);
+    num_sent++;
+
+    if (reply.command() != MyMessage::REPLY) {
+      continue;
+    }
+    if (reply.reply().status() == MyMessage::Reply::DEADLINE_EXCEEDED) {
+      num_expired++;
+      continue;
+    }
+    auto it = recorded_detections.find(request.id());
+    if (it != recorded_detections.end()) {
+      num_compared++;
+      if (it->second == count_detections(reply)) {
+        num_matched++;
+      }
+    }
+  }
+
+  double elapsed = (monotonicNanoseconds() - start) / 1e9;
+  std::cout << std::endl
+            << "Replayed " << num_sent << " request(s) in " << elapsed
+            << " seconds (" << (elapsed > 0.0 ? num_sent / elapsed : 0.0)
+            << " requests/s)" << std::endl;
+  round_trip.print();
+  std::cout << "Expired: " << num_expired << std::endl;
+  std::cout << "Detection counts matching the recording: " << num_matched
+            << "/" << num_compared << std::endl;
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " <recording> [--speed <factor>] [--shm [name]]"
+                 " [--board-ip <ip>]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // --speed 0 sends each request as soon as the previous reply arrives
+  std::string recording_path = argv[1];
+  double speed = 1.0;
+  bool use_shm = false;
+  std::string shm_name = "/kr260_yolov5";
+  std::string board_ip = "127.0.0.1";
+  for (int i = 2; i < argc; i++) {
+    if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      speed = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "--shm") == 0) {
+      use_shm = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        shm_name = argv[++i];
+      }
+    } else if (std::strcmp(argv[i], "--board-ip") == 0 && i + 1 < argc) {
+      board_ip = argv[++i];
+    } else {
+      std::cerr << "Unknown argument: " << argv[i] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  RecordingReader reader;
+  if (!reader.open(recording_path)) {
+    return EXIT_FAILURE;
+  }
+
+  if (use_shm) {
+    SharedMemoryClient client(shm_name);
+    return replay(client, reader, speed);
+  }
+  Client client(board_ip, 12345);
+  return replay(client, reader, speed);
+}